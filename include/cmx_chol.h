@@ -0,0 +1,28 @@
+#ifndef CMX_CHOL_H
+#define CMX_CHOL_H
+
+#include <cmx_matrix.h>
+
+// Width of the column panels factored by cmx_chol
+#define CMX_CHOL_BLOCK 64
+
+/*
+ *	Cholesky factorisation of symmetric positive-definite matrices.
+ *	A = L L^T, where L is lower triangular with a positive diagonal.
+ *	Only the lower triangle of A is ever read, so the upper triangle may hold anything.
+ *	Every cmx_chol_* function other than cmx_chol takes the factor L, not A.
+ *	cmx_chol, cmx_chol_solve and cmx_chol_inverse print why and return a new 0x0 matrix on failure,
+ *	such as when A is not positive definite, so check the result's size. It still needs cmx_destroy.
+ */
+
+// Factorisation
+cmx_matrix_t	cmx_chol(cmx_matrix_t);
+cmx_matrix_t	cmx_chol_update(cmx_matrix_t, cmx_matrix_t);
+cmx_matrix_t	cmx_chol_downdate(cmx_matrix_t, cmx_matrix_t);
+
+// Using the factor
+cmx_matrix_t	cmx_chol_solve(cmx_matrix_t, cmx_matrix_t);
+cmx_matrix_t	cmx_chol_inverse(cmx_matrix_t);
+double			cmx_chol_logdet(cmx_matrix_t);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef CMX_EIG_H
+#define CMX_EIG_H
+
+#include <cmx_matrix.h>
+
+// Relative residual at which an iterative eigenpair counts as converged
+#define CMX_EIG_TOL 1e-10
+// Most iterations cmx_eig_power will take
+#define CMX_EIG_MAX_ITER 10000
+// Largest Krylov basis cmx_eig_lanczos will build
+#define CMX_EIG_MAX_KRYLOV 1000
+
+/*
+ *	Eigenvalues and eigenvectors of symmetric matrices.
+ *	Eigenvalues come back as a column vector, eigenvectors as the columns of a matrix,
+ *	so column i of the vectors belongs to row i of the values.
+ *	Pass NULL for the vectors when only the values are wanted.
+ *	cmx_eig_sym and cmx_eig_lanczos print why and return a new 0x0 matrix on failure, such as a
+ *	non-square matrix or k out of range, and set the vectors to a new 0x0 matrix too. Both still need cmx_destroy.
+ */
+
+// Dense symmetric eigensolver, Householder tridiagonalisation then implicit QL
+cmx_matrix_t	cmx_eig_sym(cmx_matrix_t, cmx_matrix_t*);
+
+// Iterations that only need y = A x
+double			cmx_eig_power(cmx_matvec_f, void*, cmx_matrix_t);
+cmx_matrix_t	cmx_eig_lanczos(cmx_matvec_f, void*, size_t n, size_t k, cmx_matrix_t*);
+
+#endif
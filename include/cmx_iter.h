@@ -0,0 +1,69 @@
+#ifndef CMX_ITER_H
+#define CMX_ITER_H
+
+#include <cmx_matrix.h>
+
+// Defaults filled in by cmx_iter_defaults
+#define CMX_ITER_TOL 1e-10
+#define CMX_ITER_MAX 10000
+#define CMX_GMRES_RESTART 30
+
+/*
+ *	A preconditioner M, approximating A, that the solvers apply as z = M^-1 r.
+ *	char type - 'n'one, 'j'acobi or incomplete 'c'holesky
+ *	size_t n - The size of the system
+ *	double *data - The inverted diagonal for Jacobi, or the nonzeros of the lower factor for Cholesky, row by row
+ *	size_t *index - For Cholesky, n+1 row starts into data followed by the column of each nonzero.
+ *		Columns rise along each row, so the diagonal ends it. NULL otherwise
+ */
+typedef struct cmx_precond {
+	char type;
+	size_t n;
+	double *data;
+	size_t *index;
+} cmx_precond_t;
+
+/*
+ *	Called once per iteration with the residual relative to the right hand side
+ *	size_t iter - The iteration just finished, counting from 1
+ *	double residual - ||b - A x|| / ||b||
+ *	void *ctx - The report_ctx from the options
+ */
+typedef void (*cmx_iter_report_f)(size_t iter, double residual, void *ctx);
+
+/*
+ *	Controls for the iterative solvers, and what they found.
+ *	Get one from cmx_iter_defaults and change what is needed.
+ *	double tol - Stop once the relative residual is at most this
+ *	size_t max_iter - Give up after this many iterations, counting each GMRES inner step
+ *	size_t restart - Krylov basis size between GMRES restarts
+ *	cmx_precond_t *precond - Applied on the left for CG and on the right otherwise, or NULL
+ *	cmx_iter_report_f report - Called every iteration, or NULL
+ *	void *report_ctx - Passed through to report
+ *	size_t iterations - Set by the solver to the iterations taken
+ *	double residual - Set by the solver to the final relative residual
+ */
+typedef struct cmx_iter_opts {
+	double tol;
+	size_t max_iter;
+	size_t restart;
+	cmx_precond_t *precond;
+	cmx_iter_report_f report;
+	void *report_ctx;
+	size_t iterations;
+	double residual;
+} cmx_iter_opts_t;
+
+// Preconditioners
+cmx_precond_t	cmx_precond_jacobi(cmx_matrix_t);
+cmx_precond_t	cmx_precond_ichol(cmx_matrix_t);
+void			cmx_precond_apply(cmx_precond_t, const double *r, double *z);
+int				cmx_precond_destroy(cmx_precond_t);
+
+// Solvers for A x = b. x is an nx1 initial guess, overwritten with the solution
+cmx_iter_opts_t	cmx_iter_defaults(void);
+int				cmx_cg(cmx_matvec_f, void*, cmx_matrix_t b, cmx_matrix_t x, cmx_iter_opts_t*);
+int				cmx_bicgstab(cmx_matvec_f, void*, cmx_matrix_t b, cmx_matrix_t x, cmx_iter_opts_t*);
+int				cmx_gmres(cmx_matvec_f, void*, cmx_matrix_t b, cmx_matrix_t x, cmx_iter_opts_t*);
+
+#endif
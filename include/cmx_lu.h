@@ -0,0 +1,67 @@
+#ifndef CMX_LU_H
+#define CMX_LU_H
+
+#include <cmx_matrix.h>
+
+// Width of the column panels factored by cmx_lu
+#define CMX_LU_BLOCK 64
+// Rank of updates an updatable inverse takes before refactoring, when 0 is given
+#define CMX_UPDINV_REFACTOR 64
+
+/*
+ *	LU factorisation with partial pivoting, P A = L U.
+ *	cmx_matrix_t lu - L below the diagonal, with its unit diagonal left out, and U on and above it
+ *	size_t *pivot - Row i was swapped with row pivot[i] at step i
+ *	int sign - The sign of the permutation, +1 or -1
+ *	int singular - Non-zero if U has a zero on its diagonal
+ */
+typedef struct cmx_lu {
+	cmx_matrix_t lu;
+	size_t *pivot;
+	int sign;
+	int singular;
+} cmx_lu_t;
+
+/*
+ *	A square matrix kept alongside its inverse and determinant, so low-rank changes cost O(n^2 k)
+ *	instead of a new O(n^3) inversion. Changes go through Sherman-Morrison-Woodbury
+ *	and the determinant through the matrix determinant lemma.
+ *	Rounding error builds up with each change, so once refactor worth of rank has been applied
+ *	the inverse is recomputed from the matrix.
+ *	cmx_matrix_t a - The matrix itself
+ *	cmx_matrix_t inverse - Its inverse
+ *	double logdet - The log of the absolute value of the determinant
+ *	int sign - The sign of the determinant
+ *	size_t rank - Rank of changes applied since the inverse was last computed from scratch
+ *	size_t refactor - How much rank to apply between refactorisations
+ */
+typedef struct cmx_updinv {
+	cmx_matrix_t a;
+	cmx_matrix_t inverse;
+	double logdet;
+	int sign;
+	size_t rank;
+	size_t refactor;
+} cmx_updinv_t;
+
+// Factorisation
+cmx_lu_t		cmx_lu(cmx_matrix_t);
+void			cmx_lu_destroy(cmx_lu_t);
+
+// Using the factors. cmx_lu_solve and cmx_lu_inverse print why and return a new 0x0 matrix if A is singular
+cmx_matrix_t	cmx_lu_solve(cmx_lu_t, cmx_matrix_t);
+cmx_matrix_t	cmx_lu_inverse(cmx_lu_t);
+double			cmx_lu_det(cmx_lu_t);
+double			cmx_lu_logdet(cmx_lu_t, int*);
+
+// Updatable inverses
+cmx_updinv_t*	cmx_updinv_make(cmx_matrix_t, size_t refactor);
+int				cmx_updinv_refactor(cmx_updinv_t*);
+int				cmx_updinv_update(cmx_updinv_t*, cmx_matrix_t, cmx_matrix_t);
+int				cmx_updinv_put(cmx_updinv_t*, double, size_t r, size_t c);
+int				cmx_updinv_putr(cmx_updinv_t*, cmx_matrix_t, size_t r);
+cmx_matrix_t	cmx_updinv_inverse(cmx_updinv_t*);
+double			cmx_updinv_det(cmx_updinv_t*);
+void			cmx_updinv_destroy(cmx_updinv_t*);
+
+#endif
@@ -5,9 +5,17 @@
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
+#include <stdatomic.h>
 
 // Gets the size of the Matrix object
 #define CMX_MATRIX_SIZE sizeof(struct cmx_matrix)
+// Bytes in front of each data buffer holding its reference count, a cache line so the count and data never share one
+#define CMX_BUFFER_HEADER 64
+
+// Below this many multiply-adds, kernels stay on a single thread
+#define CMX_PARALLEL_THRESHOLD (1 << 18)
+// Products with any dimension at or below this use the classical kernel instead of recursing
+#define CMX_STRASSEN_CUTOFF 256
 
 /*
  *	The actual Matrix structure.
@@ -15,19 +23,35 @@
  *		data is stored as consecutive rows, so row 0, is directly to the left of row 1
  *	int rows - The number of rows in the Matrix
  *	int columns - the number of columns in the Matrix
+ *	atomic_size_t *refs - How many matrices share data, kept just before it.
+ *		NULL if data was allocated by the caller, in which case it is never shared
  *	
  *	Note: The size of the data array must equal r*c
+ *	Note: cmx_copy shares data and the first write makes a private copy, so always
+ *		use the matrix returned by a function that changes its argument, m = cmx_add(m, m2)
  */
 typedef struct cmx_matrix {
 	double *data;
 	size_t rows, columns;
+	atomic_size_t *refs;
 } cmx_matrix_t;
 
+/*
+ *	A matrix-vector product supplied by the caller, y = A x
+ *	const double *x - The input vector
+ *	double *y - The output vector, never aliases x
+ *	void *ctx - Whatever the caller passed alongside the function
+ *	Lets the iterative routines work on matrices that are never stored densely
+ */
+typedef void (*cmx_matvec_f)(const double *x, double *y, void *ctx);
+
 // Initialisation of matrices
 cmx_matrix_t	cmx_init(double *data, size_t r, size_t c);
 cmx_matrix_t	cmx_make(size_t r, size_t c);
 int				cmx_destroy(cmx_matrix_t);
 cmx_matrix_t	cmx_copy(cmx_matrix_t);
+cmx_matrix_t	cmx_detach(cmx_matrix_t);
+int				cmx_shared(cmx_matrix_t);
 cmx_matrix_t	cmx_identity(size_t);
 
 // Vector space Matrix functions
@@ -52,10 +76,21 @@ cmx_matrix_t	cmx_rref(cmx_matrix_t);
 
 // Matrix operations
 cmx_matrix_t	cmx_product(cmx_matrix_t, cmx_matrix_t);
+cmx_matrix_t	cmx_product_strassen(cmx_matrix_t, cmx_matrix_t);
+void			cmx_set_strassen(int);
+cmx_matrix_t	cmx_pow(cmx_matrix_t, int);
+cmx_matrix_t	cmx_expm(cmx_matrix_t);
 cmx_matrix_t	cmx_transpose(cmx_matrix_t);
 double			cmx_det(cmx_matrix_t);
 cmx_matrix_t	cmx_inverse(cmx_matrix_t);
 
+// Raw kernels on row-major arrays
+void			cmx_gemm(char ta, char tb, size_t m, size_t n, size_t k,
+					double alpha, const double *A, size_t lda,
+					const double *B, size_t ldb,
+					double beta, double *C, size_t ldc);
+void			cmx_matvec(const double *x, double *y, void *m);
+
 // Matrix data manipulation
 double			cmx_get(cmx_matrix_t, size_t r, size_t c);
 cmx_matrix_t	cmx_put(cmx_matrix_t, double, size_t r, size_t c);
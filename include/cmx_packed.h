@@ -0,0 +1,62 @@
+#ifndef CMX_PACKED_H
+#define CMX_PACKED_H
+
+#include <cmx_matrix.h>
+
+// Written where cmx_store_file would put the row count, to mark a packed record in a matrix file
+#define CMX_PACKED_MARKER ((size_t)-1)
+
+/*
+ *	A square matrix holding only the entries its structure allows to be nonzero.
+ *	char structure - 's'ymmetric, 't'riangular or 'b'anded
+ *	char uplo - Which triangle is stored for 's' and 't', 'l'ower or 'u'pper
+ *	size_t n - The number of rows and columns
+ *	size_t kl, ku - For 'b', the number of diagonals below and above the main one
+ *	double *data - The stored entries
+ *
+ *	Triangles are packed row by row, so A(i,j) is at i(i+1)/2 + j for 'l', j <= i,
+ *	and at i*n - i(i-1)/2 + j - i for 'u', j >= i. Both take n(n+1)/2 doubles.
+ *	Bands are stored as in LAPACK, one diagonal per row of a (kl+ku+1)xn array,
+ *	so A(i,j) is at (ku + i - j)*n + j and the main diagonal is row ku.
+ */
+typedef struct cmx_packed {
+	char structure;
+	char uplo;
+	size_t n;
+	size_t kl, ku;
+	double *data;
+} cmx_packed_t;
+
+/*
+ *	LU factors of a banded matrix with partial pivoting, from cmx_band_lu.
+ *	Row swaps fill U in to kl+ku diagonals above the main one, so lu holds kl below and kl+ku above.
+ *	size_t *pivot - Row j was swapped with row pivot[j] at step j
+ *	int singular - Non-zero if U has a zero on its diagonal
+ */
+typedef struct cmx_band_lu {
+	cmx_packed_t lu;
+	size_t *pivot;
+	int singular;
+} cmx_band_lu_t;
+
+// Packing and unpacking
+cmx_packed_t	cmx_pack(cmx_matrix_t, char structure, char uplo);
+cmx_packed_t	cmx_pack_band(cmx_matrix_t, size_t kl, size_t ku);
+cmx_matrix_t	cmx_unpack(cmx_packed_t);
+void			cmx_packed_destroy(cmx_packed_t);
+size_t			cmx_packed_length(cmx_packed_t);
+double			cmx_packed_get(cmx_packed_t, size_t r, size_t c);
+
+// Kernels. The solves print why and return a new 0x0 matrix if A is singular
+cmx_matrix_t	cmx_packed_product(cmx_packed_t, cmx_matrix_t);
+cmx_matrix_t	cmx_packed_solve(cmx_packed_t, cmx_matrix_t);
+cmx_band_lu_t	cmx_band_lu(cmx_packed_t);
+cmx_matrix_t	cmx_band_lu_solve(cmx_band_lu_t, cmx_matrix_t);
+void			cmx_band_lu_destroy(cmx_band_lu_t);
+
+// Storing and loading in packed form
+void			cmx_packed_store_file(cmx_packed_t*, size_t, char*, char);
+cmx_packed_t*	cmx_packed_load_file(char*, size_t);
+int				cmx_packed_fread(FILE*, cmx_packed_t*);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef CMX_TEXT_H
+#define CMX_TEXT_H
+
+#include <cmx_matrix.h>
+
+// Roughly how many bytes of text each parsing thread takes at a time
+#define CMX_TEXT_CHUNK (1 << 20)
+// Bytes the writers format across threads before each batch is written out
+#define CMX_TEXT_BUFFER (1 << 20)
+
+/*
+ *	Reading and writing matrices as text.
+ *	Readers map the file and parse chunks split at line boundaries on every thread,
+ *	working out the shape in the same pass. On failure they print why and return a 0x0 matrix.
+ *	Writers format batches of lines on every thread, printing each value with 15 significant digits
+ *	if that reads back as exactly the same double and 17 otherwise, so files always read back exactly.
+ *
+ *	CSV: one row per line, fields split by delim. ' ' splits on any run of spaces or tabs.
+ *		A first line that is not numeric is skipped as a header. Empty fields read as NAN.
+ *	Matrix Market: real, integer or pattern matrices, in coordinate or array form,
+ *		general, symmetric or skew-symmetric. Coordinate entries are summed into a dense matrix.
+ */
+
+cmx_matrix_t	cmx_load_csv(char*, char delim);
+void			cmx_store_csv(cmx_matrix_t, char*, char delim);
+cmx_matrix_t	cmx_load_mtx(char*);
+void			cmx_store_mtx(cmx_matrix_t, char*);
+
+#endif
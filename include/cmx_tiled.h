@@ -0,0 +1,66 @@
+#ifndef CMX_TILED_H
+#define CMX_TILED_H
+
+#include <cmx_matrix.h>
+
+// Tile edge used when 0 is given
+#define CMX_TILE_SIZE 512
+// Fewest tiles a cache may hold, so a tile stays loaded while two others are fetched
+#define CMX_TILED_MIN_CACHE 3
+
+/*
+ *	A cache slot holding one tile.
+ *	size_t index - Which tile, counted along tile rows, or SIZE_MAX when empty
+ *	unsigned long used - When the tile was last touched, for least recently used eviction
+ *	int dirty - Whether the tile must be written back before eviction
+ *	double *data - tile*tile values, row-major
+ */
+typedef struct cmx_tile_slot {
+	size_t index;
+	unsigned long used;
+	int dirty;
+	double *data;
+} cmx_tile_slot_t;
+
+/*
+ *	A disk-backed matrix stored as square tiles.
+ *	The file holds rows, columns and tile as size_t, then every tile in row-major tile order.
+ *	Tiles on the right and bottom edges are padded to full size with zeros,
+ *	so every tile is tile*tile doubles and whole tiles can be multiplied directly.
+ *	Only cache_size tiles are in memory at once.
+ */
+typedef struct cmx_tiled {
+	FILE *f;
+	size_t rows, columns, tile;
+	size_t tile_rows, tile_columns;
+	size_t cache_size;
+	unsigned long clock;
+	cmx_tile_slot_t *cache;
+} cmx_tiled_t;
+
+// Creating, opening and closing
+cmx_tiled_t*	cmx_tiled_create(char*, size_t r, size_t c, size_t tile, size_t cache);
+cmx_tiled_t*	cmx_tiled_open(char*, size_t cache);
+int				cmx_tiled_flush(cmx_tiled_t*);
+int				cmx_tiled_close(cmx_tiled_t*);
+
+// Element access, through the cache
+double			cmx_tiled_get(cmx_tiled_t*, size_t r, size_t c);
+cmx_tiled_t*	cmx_tiled_put(cmx_tiled_t*, double, size_t r, size_t c);
+
+// Conversion to and from in-memory matrices and cmx_store_file files
+cmx_tiled_t*	cmx_tiled_from_matrix(cmx_matrix_t, char*, size_t tile, size_t cache);
+cmx_matrix_t	cmx_tiled_to_matrix(cmx_tiled_t*);
+cmx_tiled_t*	cmx_tiled_from_file(char*, size_t index, char*, size_t tile, size_t cache);
+void			cmx_tiled_store_file(cmx_tiled_t*, char*, char);
+
+// Out-of-core operations
+cmx_tiled_t*	cmx_tiled_product(cmx_tiled_t*, cmx_tiled_t*, char*);
+cmx_tiled_t*	cmx_tiled_transpose(cmx_tiled_t*, char*);
+cmx_tiled_t*	cmx_tiled_add(cmx_tiled_t*, cmx_tiled_t*);
+double			cmx_tiled_sum(cmx_tiled_t*);
+double			cmx_tiled_mean(cmx_tiled_t*);
+double			cmx_tiled_sqsum(cmx_tiled_t*);
+double			cmx_tiled_rms(cmx_tiled_t*);
+
+#endif
@@ -0,0 +1,246 @@
+#include <cmx_chol.h>
+
+/*
+ * Factors a small diagonal block in place, reading and writing only its lower triangle
+ * double *a - The top left of the block
+ * size_t lda - The row stride of the array the block lives in
+ * size_t b - The size of the block
+ * Returns non-zero if the block is not positive definite
+ */
+static int chol_unblocked(double *a, size_t lda, size_t b){
+	for(size_t j = 0; j < b; j++){
+		double *aj = a + j*lda;
+		double d = aj[j];
+		for(size_t p = 0; p < j; p++)
+			d -= aj[p] * aj[p];
+		if(!(d > 0)) return 1;
+		aj[j] = sqrt(d);
+		for(size_t i = j+1; i < b; i++){
+			double *ai = a + i*lda;
+			double t = ai[j];
+			for(size_t p = 0; p < j; p++)
+				t -= ai[p] * aj[p];
+			ai[j] = t / aj[j];
+		}
+	}
+	return 0;
+}
+
+/*
+ * Produces the Cholesky factor L of a symmetric positive-definite matrix, so that m = L L^T
+ * Blocked and right-looking: each panel of CMX_CHOL_BLOCK columns is factored,
+ * then the trailing lower triangle is updated with cmx_gemm, split across threads
+ * Only the lower triangle of m is read. The upper triangle of L is zero
+ * cmx_matrix_t m - The matrix to factor
+ */
+cmx_matrix_t cmx_chol(cmx_matrix_t m){
+	if(m.rows != m.columns){
+		printf("ERROR: cannot find Cholesky factor of %zux%zu matrix. Matrix not square.\n", m.rows, m.columns);
+		return cmx_make(0, 0);
+	}
+	size_t n = m.rows;
+	cmx_matrix_t L = cmx_detach(cmx_copy(m));
+	double *a = L.data;
+
+	for(size_t k0 = 0; k0 < n; k0 += CMX_CHOL_BLOCK){
+		size_t k1 = (k0 + CMX_CHOL_BLOCK < n)? k0 + CMX_CHOL_BLOCK: n;
+		size_t b = k1 - k0;
+
+		if(chol_unblocked(a + k0*n + k0, n, b)){
+			printf("ERROR: Matrix not positive definite, cannot find Cholesky factor.\n");
+			cmx_destroy(L);
+			return cmx_make(0, 0);
+		}
+
+		// Panel below the diagonal block, L21 = A21 L11^-T
+		#pragma omp parallel for if((n-k1)*b*b >= CMX_PARALLEL_THRESHOLD)
+		for(size_t i = k1; i < n; i++){
+			double *ai = a + i*n + k0;
+			for(size_t j = 0; j < b; j++){
+				double *lj = a + (k0+j)*n + k0;
+				double t = ai[j];
+				for(size_t p = 0; p < j; p++)
+					t -= ai[p] * lj[p];
+				ai[j] = t / lj[j];
+			}
+		}
+
+		// Trailing lower triangle, A22 -= L21 L21^T, one block row at a time
+		#pragma omp parallel for schedule(dynamic) if((n-k1)*(n-k1)*b >= CMX_PARALLEL_THRESHOLD)
+		for(size_t i0 = k1; i0 < n; i0 += CMX_CHOL_BLOCK){
+			size_t i1 = (i0 + CMX_CHOL_BLOCK < n)? i0 + CMX_CHOL_BLOCK: n;
+			cmx_gemm('n', 't', i1-i0, i1-k1, b,
+					-1.0, a + i0*n + k0, n, a + k1*n + k0, n,
+					1.0, a + i0*n + k1, n);
+		}
+	}
+
+	for(size_t i = 0; i < n; i++)
+		for(size_t j = i+1; j < n; j++)
+			a[i*n + j] = 0;
+	return L;
+}
+
+/*
+ * Solves A X = B for X, given the Cholesky factor of A
+ * Forward then backward substitution, blocked so the bulk of the work is in cmx_gemm
+ * cmx_matrix_t L - The Cholesky factor of A, from cmx_chol
+ * cmx_matrix_t B - The right hand sides, one per column
+ * Produces a new matrix the same size as B
+ */
+cmx_matrix_t cmx_chol_solve(cmx_matrix_t L, cmx_matrix_t B){
+	if(L.rows != L.columns || B.rows != L.rows){
+		printf("ERROR: Size mismatch solving with Cholesky factor %zux%zu and right hand side %zux%zu\n", L.rows, L.columns, B.rows, B.columns);
+		return cmx_make(0, 0);
+	}
+	size_t n = L.rows, k = B.columns;
+	cmx_matrix_t X = cmx_detach(cmx_copy(B));
+	double *l = L.data, *x = X.data;
+
+	// Forward substitution, L Y = B
+	for(size_t i0 = 0; i0 < n; i0 += CMX_CHOL_BLOCK){
+		size_t i1 = (i0 + CMX_CHOL_BLOCK < n)? i0 + CMX_CHOL_BLOCK: n;
+		cmx_gemm('n', 'n', i1-i0, k, i0,
+				-1.0, l + i0*n, n, x, k, 1.0, x + i0*k, k);
+		for(size_t i = i0; i < i1; i++){
+			double *xi = x + i*k;
+			for(size_t p = i0; p < i; p++){
+				double s = l[i*n + p];
+				double *xp = x + p*k;
+				for(size_t j = 0; j < k; j++)
+					xi[j] -= s * xp[j];
+			}
+			double d = l[i*n + i];
+			for(size_t j = 0; j < k; j++)
+				xi[j] /= d;
+		}
+	}
+
+	// Backward substitution, L^T X = Y
+	for(size_t i1 = n; i1 > 0; ){
+		size_t i0 = (i1 > CMX_CHOL_BLOCK)? i1 - CMX_CHOL_BLOCK: 0;
+		cmx_gemm('t', 'n', i1-i0, k, n-i1,
+				-1.0, l + i1*n + i0, n, x + i1*k, k, 1.0, x + i0*k, k);
+		for(size_t i = i1; i-- > i0; ){
+			double *xi = x + i*k;
+			for(size_t p = i+1; p < i1; p++){
+				double s = l[p*n + i];
+				double *xp = x + p*k;
+				for(size_t j = 0; j < k; j++)
+					xi[j] -= s * xp[j];
+			}
+			double d = l[i*n + i];
+			for(size_t j = 0; j < k; j++)
+				xi[j] /= d;
+		}
+		i1 = i0;
+	}
+	return X;
+}
+
+/*
+ * Produces the inverse of A given its Cholesky factor. The result is exactly symmetric
+ * cmx_matrix_t L - The Cholesky factor of A, from cmx_chol
+ */
+cmx_matrix_t cmx_chol_inverse(cmx_matrix_t L){
+	if(L.rows != L.columns){
+		printf("ERROR: canot find inverse from %zux%zu Cholesky factor. Matrix not square.\n", L.rows, L.columns);
+		return cmx_make(0, 0);
+	}
+	size_t n = L.rows;
+	cmx_matrix_t I = cmx_make(n, n);
+	for(size_t i = 0; i < n; i++)
+		I.data[i*n + i] = 1.0;
+	cmx_matrix_t inverse = cmx_chol_solve(L, I);
+	cmx_destroy(I);
+
+	for(size_t i = 0; i < n; i++)
+		for(size_t j = i+1; j < n; j++)
+			inverse.data[i*n + j] = inverse.data[j*n + i];
+	return inverse;
+}
+
+/*
+ * Gets the natural log of the determinant of A given its Cholesky factor
+ * Does not overflow where cmx_det would
+ * cmx_matrix_t L - The Cholesky factor of A, from cmx_chol
+ */
+double cmx_chol_logdet(cmx_matrix_t L){
+	if(L.rows != L.columns){
+		printf("Error: Can't find the determinant from a non-square %zux%zu Cholesky factor!", L.rows, L.columns);
+		return 0;
+	}
+	double d = 0;
+	for(size_t i = 0; i < L.rows; i++)
+		d += log(L.data[i*L.columns + i]);
+	return 2*d;
+}
+
+/*
+ * Applies a rank-1 change to a Cholesky factor in O(n^2), so L L^T becomes L L^T + sign x x^T
+ * Returns non-zero if the result would not be positive definite
+ */
+static int chol_rank1(cmx_matrix_t L, cmx_matrix_t x, double sign){
+	size_t n = L.rows;
+	double *l = L.data;
+	double *w = (double*)malloc(sizeof(double) * n);
+	for(size_t i = 0; i < n; i++)
+		w[i] = x.data[i];
+
+	for(size_t k = 0; k < n; k++){
+		double lkk = l[k*n + k];
+		double r2 = lkk*lkk + sign*w[k]*w[k];
+		if(!(r2 > 0)){
+			free(w);
+			return 1;
+		}
+		double r = sqrt(r2);
+		double c = r / lkk, s = w[k] / lkk;
+		l[k*n + k] = r;
+		for(size_t i = k+1; i < n; i++){
+			l[i*n + k] = (l[i*n + k] + sign*s*w[i]) / c;
+			w[i] = c*w[i] - s*l[i*n + k];
+		}
+	}
+	free(w);
+	return 0;
+}
+
+/*
+ * Updates a Cholesky factor in place so it factors A + x x^T
+ * cmx_matrix_t L - The Cholesky factor of A, overwritten with the result. Use the returned matrix
+ * cmx_matrix_t x - The column vector of the update, nx1. Left unchanged
+ */
+cmx_matrix_t cmx_chol_update(cmx_matrix_t L, cmx_matrix_t x){
+	if(L.rows != L.columns || x.rows != L.rows || x.columns != 1){
+		printf("ERROR: Size mismatch updating %zux%zu Cholesky factor with %zux%zu. Make sure it is a column vector\n", L.rows, L.columns, x.rows, x.columns);
+		return L;
+	}
+	L = cmx_detach(L);
+	chol_rank1(L, x, 1.0);
+	return L;
+}
+
+/*
+ * Downdates a Cholesky factor in place so it factors A - x x^T
+ * If A - x x^T is not positive definite, L is left unchanged
+ * cmx_matrix_t L - The Cholesky factor of A, overwritten with the result. Use the returned matrix
+ * cmx_matrix_t x - The column vector of the downdate, nx1. Left unchanged
+ */
+cmx_matrix_t cmx_chol_downdate(cmx_matrix_t L, cmx_matrix_t x){
+	if(L.rows != L.columns || x.rows != L.rows || x.columns != 1){
+		printf("ERROR: Size mismatch downdating %zux%zu Cholesky factor with %zux%zu. Make sure it is a column vector\n", L.rows, L.columns, x.rows, x.columns);
+		return L;
+	}
+	L = cmx_detach(L);
+	cmx_matrix_t W = cmx_make(L.rows, L.columns);
+	for(size_t i = 0; i < L.rows*L.columns; i++)
+		W.data[i] = L.data[i];
+	if(chol_rank1(W, x, -1.0))
+		printf("ERROR: Downdated matrix not positive definite, leaving Cholesky factor unchanged.\n");
+	else
+		for(size_t i = 0; i < L.rows*L.columns; i++)
+			L.data[i] = W.data[i];
+	cmx_destroy(W);
+	return L;
+}
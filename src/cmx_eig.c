@@ -0,0 +1,473 @@
+#include <cmx_eig.h>
+
+/*
+ * Reduces a symmetric matrix to tridiagonal form with Householder reflections
+ * Works on the transpose of the matrix, so every inner loop runs along a row
+ * double *w - The transposed matrix, nxn. Only its upper triangle is read.
+ *	If want_vectors is set, it is overwritten with the transform, one basis vector per row
+ * double *d - Output diagonal, n long
+ * double *e - Output subdiagonal, n long, with e[i] coupling i-1 and i. e[0] is zero
+ */
+static void eig_tridiagonalise(double *w, size_t n, double *d, double *e, int want_vectors){
+	for(size_t j = 0; j < n; j++)
+		d[j] = w[j*n + n-1];
+
+	for(size_t i = n-1; i > 0; i--){
+		double scale = 0, h = 0;
+		for(size_t k = 0; k < i; k++)
+			scale += fabs(d[k]);
+
+		if(scale == 0){
+			e[i] = d[i-1];
+			for(size_t j = 0; j < i; j++){
+				d[j] = w[j*n + i-1];
+				w[j*n + i] = 0;
+				w[i*n + j] = 0;
+			}
+		} else {
+			// Generate the Householder vector in d
+			for(size_t k = 0; k < i; k++){
+				d[k] /= scale;
+				h += d[k] * d[k];
+			}
+			double f = d[i-1];
+			double g = sqrt(h);
+			if(f > 0) g = -g;
+			e[i] = scale * g;
+			h -= f * g;
+			d[i-1] = f - g;
+			for(size_t j = 0; j < i; j++)
+				e[j] = 0;
+
+			// e = A d, using the upper triangle only
+			for(size_t j = 0; j < i; j++){
+				double *wj = w + j*n;
+				f = d[j];
+				w[i*n + j] = f;
+				g = e[j] + wj[j] * f;
+				for(size_t k = j+1; k < i; k++){
+					g += wj[k] * d[k];
+					e[k] += wj[k] * f;
+				}
+				e[j] = g;
+			}
+			f = 0;
+			for(size_t j = 0; j < i; j++){
+				e[j] /= h;
+				f += e[j] * d[j];
+			}
+			double hh = f / (h + h);
+			for(size_t j = 0; j < i; j++)
+				e[j] -= hh * d[j];
+
+			// Rank 2 update of the leading block
+			#pragma omp parallel for schedule(dynamic, 16) if(i*i >= CMX_PARALLEL_THRESHOLD)
+			for(size_t j = 0; j < i; j++){
+				double *wj = w + j*n;
+				double fj = d[j], gj = e[j];
+				for(size_t k = j; k < i; k++)
+					wj[k] -= fj * e[k] + gj * d[k];
+			}
+			for(size_t j = 0; j < i; j++){
+				d[j] = w[j*n + i-1];
+				w[j*n + i] = 0;
+			}
+		}
+		d[i] = h;
+	}
+	e[0] = 0;
+
+	if(!want_vectors){
+		for(size_t j = 0; j < n; j++)
+			d[j] = w[j*n + j];
+		return;
+	}
+
+	// Accumulate the reflections into w
+	for(size_t i = 0; i+1 < n; i++){
+		w[i*n + n-1] = w[i*n + i];
+		w[i*n + i] = 1;
+		double h = d[i+1];
+		double *wi = w + (i+1)*n;
+		if(h != 0){
+			for(size_t k = 0; k <= i; k++)
+				d[k] = wi[k] / h;
+			#pragma omp parallel for if(i*i >= CMX_PARALLEL_THRESHOLD)
+			for(size_t j = 0; j <= i; j++){
+				double *wj = w + j*n;
+				double g = 0;
+				for(size_t k = 0; k <= i; k++)
+					g += wi[k] * wj[k];
+				for(size_t k = 0; k <= i; k++)
+					wj[k] -= g * d[k];
+			}
+		}
+		for(size_t k = 0; k <= i; k++)
+			wi[k] = 0;
+	}
+	for(size_t j = 0; j < n; j++){
+		d[j] = w[j*n + n-1];
+		w[j*n + n-1] = 0;
+	}
+	w[(n-1)*n + n-1] = 1;
+}
+
+/*
+ * Eigenvalues of a symmetric tridiagonal matrix by the implicit QL method, sorted ascending
+ * double *d - The diagonal, n long, overwritten with the eigenvalues
+ * double *e - The off diagonal, n long, with e[i] coupling i and i+1. Destroyed
+ * double *w - n rows of len values, rotated along with the eigenvalues, or NULL.
+ *	Starting from the identity gives the eigenvectors as rows
+ * Returns non-zero if an eigenvalue failed to converge
+ */
+static int eig_tridiag_ql(double *d, double *e, size_t n, double *w, size_t len){
+	double f = 0, tst1 = 0, eps = pow(2.0, -52.0);
+	if(n == 0) return 0;
+	e[n-1] = 0;
+
+	for(size_t l = 0; l < n; l++){
+		// Find a small subdiagonal element to split at
+		tst1 = fmax(tst1, fabs(d[l]) + fabs(e[l]));
+		size_t m = l;
+		while(m < n-1 && fabs(e[m]) > eps*tst1)
+			m++;
+
+		int iter = 0;
+		while(m > l){
+			if(++iter > 60) return 1;
+
+			// Implicit shift
+			double g = d[l];
+			double p = (d[l+1] - g) / (2.0 * e[l]);
+			double r = hypot(p, 1.0);
+			if(p < 0) r = -r;
+			d[l] = e[l] / (p + r);
+			d[l+1] = e[l] * (p + r);
+			double dl1 = d[l+1];
+			double h = g - d[l];
+			for(size_t i = l+2; i < n; i++)
+				d[i] -= h;
+			f += h;
+
+			// Implicit QL sweep
+			p = d[m];
+			double c = 1, c2 = 1, c3 = 1, s = 0, s2 = 0;
+			double el1 = e[l+1];
+			for(size_t i = m; i-- > l; ){
+				c3 = c2;
+				c2 = c;
+				s2 = s;
+				g = c * e[i];
+				h = c * p;
+				r = hypot(p, e[i]);
+				e[i+1] = s * r;
+				s = e[i] / r;
+				c = p / r;
+				p = c * d[i] - s * g;
+				d[i+1] = h + s * (c * g + s * d[i]);
+				if(w != NULL){
+					double *wi = w + i*len, *wi1 = w + (i+1)*len;
+					for(size_t k = 0; k < len; k++){
+						h = wi1[k];
+						wi1[k] = s * wi[k] + c * h;
+						wi[k] = c * wi[k] - s * h;
+					}
+				}
+			}
+			p = -s * s2 * c3 * el1 * e[l] / dl1;
+			e[l] = s * p;
+			d[l] = c * p;
+			if(fabs(e[l]) <= eps*tst1) break;
+		}
+		d[l] += f;
+		e[l] = 0;
+	}
+
+	// Selection sort, so each row of w only moves once
+	for(size_t i = 0; i+1 < n; i++){
+		size_t k = i;
+		double p = d[i];
+		for(size_t j = i+1; j < n; j++)
+			if(d[j] < p){
+				k = j;
+				p = d[j];
+			}
+		if(k != i){
+			d[k] = d[i];
+			d[i] = p;
+			if(w != NULL)
+				for(size_t j = 0; j < len; j++){
+					p = w[i*len + j];
+					w[i*len + j] = w[k*len + j];
+					w[k*len + j] = p;
+				}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Finds every eigenvalue, and optionally eigenvector, of a symmetric matrix
+ * Householder tridiagonalisation followed by the implicit QL method, O(n^3)
+ * Only the lower triangle of m is read
+ * cmx_matrix_t m - The matrix to decompose
+ * cmx_matrix_t *vectors - Set to a new nxn matrix of orthonormal eigenvectors as columns, or NULL to skip them
+ * Produces an nx1 column vector of the eigenvalues in ascending order,
+ * or a 0x0 matrix, with vectors set to one, if m is not square or memory runs out
+ */
+cmx_matrix_t cmx_eig_sym(cmx_matrix_t m, cmx_matrix_t *vectors){
+	if(m.rows != m.columns){
+		printf("ERROR: cannot find eigenvalues of %zux%zu matrix. Matrix not square.\n", m.rows, m.columns);
+		if(vectors != NULL)
+			*vectors = cmx_make(0, 0);
+		return cmx_make(0, 0);
+	}
+	size_t n = m.rows;
+	cmx_matrix_t values = cmx_make(n, 1);
+	if(n == 0){
+		if(vectors != NULL)
+			*vectors = cmx_make(0, 0);
+		return values;
+	}
+
+	cmx_matrix_t w = cmx_transpose(m);
+	double *e = (double*)malloc(sizeof(double) * n);
+	if(values.rows != n || w.rows != n || e == NULL){
+		printf("ERROR: Out of memory finding eigenvalues of %zux%zu matrix.\n", n, n);
+		free(e);
+		cmx_destroy(w);
+		cmx_destroy(values);
+		if(vectors != NULL)
+			*vectors = cmx_make(0, 0);
+		return cmx_make(0, 0);
+	}
+
+	eig_tridiagonalise(w.data, n, values.data, e, vectors != NULL);
+	for(size_t i = 1; i < n; i++)
+		e[i-1] = e[i];
+	if(eig_tridiag_ql(values.data, e, n, vectors? w.data: NULL, n))
+		printf("ERROR: Eigenvalues failed to converge, results are inaccurate.\n");
+	free(e);
+
+	if(vectors != NULL)
+		*vectors = cmx_transpose(w);
+	cmx_destroy(w);
+	return values;
+}
+
+/*
+ * Finds the eigenvalue of largest magnitude and its eigenvector by power iteration
+ * Needs only y = A x and two vectors of storage, but converges slowly when the top two magnitudes are close
+ * cmx_matvec_f f - Computes y = A x
+ * void *ctx - Passed through to f
+ * cmx_matrix_t v - An nx1 starting guess, overwritten with the unit eigenvector. Random if all zero. Must not be shared
+ */
+double cmx_eig_power(cmx_matvec_f f, void *ctx, cmx_matrix_t v){
+	if(v.columns != 1){
+		printf("Error: Power iteration needs a %zux%zu starting vector to be a column vector\n", v.rows, v.columns);
+		return 0;
+	}
+	if(cmx_shared(v)){
+		printf("Error: Power iteration writes the eigenvector into a starting vector that is shared. Call cmx_detach first\n");
+		return 0;
+	}
+	size_t n = v.rows;
+	double *y = (double*)malloc(sizeof(double) * n);
+	double lambda = 0, norm = cmx_rsqsum(v);
+
+	if(norm == 0){
+		cmx_noise(v);
+		norm = cmx_rsqsum(v);
+	}
+	cmx_scalar(v, 1/norm);
+
+	size_t it;
+	for(it = 0; it < CMX_EIG_MAX_ITER; it++){
+		(*f)(v.data, y, ctx);
+		lambda = 0;
+		for(size_t i = 0; i < n; i++)
+			lambda += v.data[i] * y[i];
+
+		double r = 0, ynorm = 0;
+		for(size_t i = 0; i < n; i++){
+			double t = y[i] - lambda * v.data[i];
+			r += t * t;
+			ynorm += y[i] * y[i];
+		}
+		if(sqrt(r) <= CMX_EIG_TOL * fabs(lambda) || ynorm == 0) break;
+
+		ynorm = sqrt(ynorm);
+		for(size_t i = 0; i < n; i++)
+			v.data[i] = y[i] / ynorm;
+	}
+	if(it == CMX_EIG_MAX_ITER)
+		printf("ERROR: Power iteration did not converge in %d iterations.\n", CMX_EIG_MAX_ITER);
+
+	free(y);
+	return lambda;
+}
+
+/*
+ * Fills q with a random unit vector orthogonal to the first j rows of Q
+ * Returns non-zero if Q already spans everything
+ */
+static int lanczos_random(double *Q, size_t n, size_t j, double *q, double *h){
+	for(size_t i = 0; i < n; i++)
+		q[i] = (double)rand()/RAND_MAX - 0.5;
+	for(int pass = 0; pass < 2 && j > 0; pass++){
+		cmx_gemm('n', 't', j, 1, n, 1.0, Q, n, q, n, 0.0, h, 1);
+		cmx_gemm('t', 'n', n, 1, j, -1.0, Q, n, h, 1, 1.0, q, 1);
+	}
+	double norm = 0;
+	for(size_t i = 0; i < n; i++)
+		norm += q[i] * q[i];
+	norm = sqrt(norm);
+	if(norm < 1e-8) return 1;
+	for(size_t i = 0; i < n; i++)
+		q[i] /= norm;
+	return 0;
+}
+
+/*
+ * Finds the k largest eigenvalues, and optionally eigenvectors, of a large symmetric matrix
+ * Lanczos iteration with full reorthogonalisation, stopping once all k Ritz pairs have converged.
+ * Costs one y = A x per step plus O(n m) for a basis of m vectors, so suits k much smaller than n.
+ * The basis is stored in full and doubles in size as it grows, so memory is only taken for steps actually used.
+ * Returns a 0x0 matrix, and sets vectors to one, if k is 0 or more than n or not even the starting basis fits in memory
+ * Start vectors come from rand(), so call srand first as for cmx_noise
+ * cmx_matvec_f f - Computes y = A x for the symmetric matrix A
+ * void *ctx - Passed through to f
+ * size_t n - The size of A
+ * size_t k - How many eigenpairs to find
+ * cmx_matrix_t *vectors - Set to a new nxk matrix of unit eigenvectors as columns, or NULL to skip them
+ * Produces a kx1 column vector of the eigenvalues in descending order
+ */
+cmx_matrix_t cmx_eig_lanczos(cmx_matvec_f f, void *ctx, size_t n, size_t k, cmx_matrix_t *vectors){
+	if(k == 0 || k > n){
+		printf("ERROR: Cannot find %zu eigenvalues of a %zux%zu matrix\n", k, n, n);
+		if(vectors != NULL)
+			*vectors = cmx_make(0, 0);
+		return cmx_make(0, 0);
+	}
+	size_t mmax = (2*k > CMX_EIG_MAX_KRYLOV)? 2*k: CMX_EIG_MAX_KRYLOV;
+	if(mmax > n) mmax = n;
+
+	// The basis starts small and doubles as needed, since most runs converge long before mmax
+	size_t cap = (2*k + 16 < mmax)? 2*k + 16: mmax;
+	double *Q = (double*)malloc(sizeof(double) * cap * n);
+	double *w = (double*)malloc(sizeof(double) * n);
+	double *h = (double*)malloc(sizeof(double) * mmax);
+	double *alpha = (double*)malloc(sizeof(double) * mmax);
+	double *beta = (double*)malloc(sizeof(double) * mmax);
+	double *d = (double*)malloc(sizeof(double) * mmax);
+	double *e = (double*)malloc(sizeof(double) * mmax);
+	double *z = (double*)malloc(sizeof(double) * mmax);
+	if(!Q || !w || !h || !alpha || !beta || !d || !e || !z){
+		printf("ERROR: Out of memory for a Lanczos basis of %zu vectors of length %zu.\n", cap, n);
+		free(Q); free(w); free(h); free(alpha); free(beta); free(d); free(e); free(z);
+		if(vectors != NULL)
+			*vectors = cmx_make(0, 0);
+		return cmx_make(0, 0);
+	}
+	size_t m = 0;
+	int converged = 0;
+
+	lanczos_random(Q, n, 0, Q, h);
+	while(m < mmax){
+		double *q = Q + m*n;
+		(*f)(q, w, ctx);
+
+		// Project out the whole basis twice, which also gives alpha and the previous beta
+		alpha[m] = 0;
+		for(int pass = 0; pass < 2; pass++){
+			cmx_gemm('n', 't', m+1, 1, n, 1.0, Q, n, w, n, 0.0, h, 1);
+			cmx_gemm('t', 'n', n, 1, m+1, -1.0, Q, n, h, 1, 1.0, w, 1);
+			alpha[m] += h[m];
+		}
+		double b = 0;
+		for(size_t i = 0; i < n; i++)
+			b += w[i] * w[i];
+		beta[m] = b = sqrt(b);
+		m++;
+		if(m == mmax) break;
+		if(m == cap){
+			size_t grown = (2*cap < mmax)? 2*cap: mmax;
+			double *Qg = (double*)realloc(Q, sizeof(double) * grown * n);
+			if(Qg == NULL){
+				printf("ERROR: Out of memory growing the Lanczos basis past %zu vectors, results are inaccurate.\n", cap);
+				break;
+			}
+			Q = Qg;
+			cap = grown;
+		}
+
+		// An invariant subspace was found, carry on from a fresh direction
+		if(b <= CMX_EIG_TOL * fabs(alpha[m-1]) || b == 0){
+			beta[m-1] = 0;
+			if(lanczos_random(Q, n, m, Q + m*n, h)) break;
+			continue;
+		}
+
+		// Residual of each Ritz pair is beta times the last entry of its eigenvector
+		if(m >= k){
+			for(size_t i = 0; i < m; i++){
+				d[i] = alpha[i];
+				e[i] = beta[i];
+				z[i] = (i == m-1);
+			}
+			eig_tridiag_ql(d, e, m, z, 1);
+			double scale = fmax(fabs(d[0]), fabs(d[m-1]));
+			converged = 1;
+			for(size_t i = m-k; i < m; i++)
+				if(fabs(b * z[i]) > CMX_EIG_TOL * scale) converged = 0;
+			if(converged) break;
+		}
+
+		double *qn = Q + m*n;
+		for(size_t i = 0; i < n; i++)
+			qn[i] = w[i] / b;
+	}
+	if(!converged && m == mmax && mmax < n)
+		printf("ERROR: Lanczos did not converge within %zu steps, results are inaccurate.\n", mmax);
+
+	// Final Ritz pairs from the tridiagonal matrix of the whole basis
+	double *S = (vectors != NULL)? (double*)calloc(m * m, sizeof(double)): NULL;
+	if(vectors != NULL && S == NULL){
+		printf("ERROR: Out of memory for Lanczos eigenvectors, returning only eigenvalues.\n");
+		*vectors = cmx_make(0, 0);
+		vectors = NULL;
+	}
+	for(size_t i = 0; i < m; i++){
+		d[i] = alpha[i];
+		e[i] = beta[i];
+		if(S != NULL) S[i*m + i] = 1;
+	}
+	eig_tridiag_ql(d, e, m, S, m);
+
+	cmx_matrix_t values = cmx_make(k, 1);
+	for(size_t i = 0; i < k; i++)
+		values.data[i] = d[m-1-i];
+
+	if(vectors != NULL){
+		// Reverse the top k rows of S for descending order, then map back through the basis
+		cmx_matrix_t Sk = cmx_make(k, m), Y = cmx_make(k, n);
+		for(size_t i = 0; i < k; i++)
+			for(size_t j = 0; j < m; j++)
+				Sk.data[i*m + j] = S[(m-1-i)*m + j];
+		cmx_gemm('n', 'n', k, n, m, 1.0, Sk.data, m, Q, n, 0.0, Y.data, n);
+		*vectors = cmx_transpose(Y);
+		cmx_destroy(Sk);
+		cmx_destroy(Y);
+		free(S);
+	}
+
+	free(Q);
+	free(w);
+	free(h);
+	free(alpha);
+	free(beta);
+	free(d);
+	free(e);
+	free(z);
+	return values;
+}
@@ -0,0 +1,508 @@
+#include <cmx_iter.h>
+
+/*
+ * Fused vector kernels. Each makes a single pass over its vectors,
+ * so a solver iteration touches memory as few times as possible and never allocates
+ */
+
+// Returns x . y
+static double vec_dot(const double *x, const double *y, size_t n){
+	double d = 0;
+	#pragma omp parallel for reduction(+:d) if(n >= CMX_PARALLEL_THRESHOLD)
+	for(size_t i = 0; i < n; i++)
+		d += x[i] * y[i];
+	return d;
+}
+
+// x += a p, r -= a q, and returns r . r
+static double vec_step(double *x, const double *p, double *r, const double *q, double a, size_t n){
+	double rr = 0;
+	#pragma omp parallel for reduction(+:rr) if(n >= CMX_PARALLEL_THRESHOLD)
+	for(size_t i = 0; i < n; i++){
+		x[i] += a * p[i];
+		r[i] -= a * q[i];
+		rr += r[i] * r[i];
+	}
+	return rr;
+}
+
+// y = x + a y
+static void vec_xpay(const double *x, double a, double *y, size_t n){
+	#pragma omp parallel for if(n >= CMX_PARALLEL_THRESHOLD)
+	for(size_t i = 0; i < n; i++)
+		y[i] = x[i] + a * y[i];
+}
+
+// r = b - r, and returns r . r
+static double vec_residual(const double *b, double *r, size_t n){
+	double rr = 0;
+	#pragma omp parallel for reduction(+:rr) if(n >= CMX_PARALLEL_THRESHOLD)
+	for(size_t i = 0; i < n; i++){
+		r[i] = b[i] - r[i];
+		rr += r[i] * r[i];
+	}
+	return rr;
+}
+
+/*
+ * Gets the default solver options
+ */
+cmx_iter_opts_t cmx_iter_defaults(void){
+	cmx_iter_opts_t opts = {CMX_ITER_TOL, CMX_ITER_MAX, CMX_GMRES_RESTART, NULL, NULL, NULL, 0, 0};
+	return opts;
+}
+
+/*
+ * Makes a Jacobi preconditioner, M = diag(A)
+ * cmx_matrix_t m - Either the square matrix A, or an nx1 column vector holding its diagonal
+ */
+cmx_precond_t cmx_precond_jacobi(cmx_matrix_t m){
+	cmx_precond_t p = {'n', m.rows, NULL, NULL};
+	if(m.columns != 1 && m.columns != m.rows){
+		printf("ERROR: cannot make Jacobi preconditioner from %zux%zu matrix. Give a square matrix or its diagonal.\n", m.rows, m.columns);
+		return p;
+	}
+	size_t step = (m.columns == 1)? 1: m.columns + 1;
+	p.data = (double*)malloc(sizeof(double) * m.rows);
+	for(size_t i = 0; i < m.rows; i++){
+		double d = m.data[i*step];
+		if(d == 0){
+			printf("ERROR: Zero on the diagonal at %zu, cannot make Jacobi preconditioner.\n", i);
+			free(p.data);
+			p.data = NULL;
+			return p;
+		}
+		p.data[i] = 1/d;
+	}
+	p.type = 'j';
+	return p;
+}
+
+/*
+ * Sparse dot product of the parts of two rows of the factor left of column j
+ * Both rows are in rising column order, so they are merged in one pass
+ */
+static double ichol_dot(const double *l, const size_t *col, size_t a0, size_t a1, size_t b0, size_t b1, size_t j){
+	double t = 0;
+	while(a0 < a1 && b0 < b1 && col[a0] < j && col[b0] < j){
+		if(col[a0] == col[b0])
+			t += l[a0++] * l[b0++];
+		else if(col[a0] < col[b0])
+			a0++;
+		else
+			b0++;
+	}
+	return t;
+}
+
+/*
+ * Makes an incomplete Cholesky preconditioner, IC(0), M = L L^T
+ * L keeps only the nonzeros of the lower triangle of A and is stored compressed by row,
+ * so building it costs O(nnz x row length) after one scan of A and each application costs O(nnz).
+ * This only pays off over cmx_chol when A is sparse; for a dense A it is a full, unblocked factorisation
+ * Falls back to Jacobi if the factorisation breaks down
+ * cmx_matrix_t m - The symmetric positive-definite matrix A. Only the lower triangle is read
+ */
+cmx_precond_t cmx_precond_ichol(cmx_matrix_t m){
+	cmx_precond_t p = {'n', m.rows, NULL, NULL};
+	if(m.rows != m.columns){
+		printf("ERROR: cannot make incomplete Cholesky preconditioner from %zux%zu matrix. Matrix not square.\n", m.rows, m.columns);
+		return p;
+	}
+	size_t n = m.rows, nnz = 0;
+	for(size_t i = 0; i < n; i++)
+		for(size_t j = 0; j < i; j++)
+			nnz += (m.data[i*n + j] != 0);
+	nnz += n;
+
+	size_t *index = (size_t*)malloc(sizeof(size_t) * (n + 1 + nnz));
+	double *l = (double*)malloc(sizeof(double) * nnz);
+	if(index == NULL || l == NULL){
+		printf("ERROR: Out of memory for incomplete Cholesky with %zu nonzeros, using Jacobi instead.\n", nnz);
+		free(index);
+		free(l);
+		return cmx_precond_jacobi(m);
+	}
+	size_t *start = index, *col = index + n + 1;
+	size_t at = 0;
+	for(size_t i = 0; i < n; i++){
+		start[i] = at;
+		for(size_t j = 0; j < i; j++)
+			if(m.data[i*n + j] != 0){
+				col[at] = j;
+				l[at++] = m.data[i*n + j];
+			}
+		col[at] = i;
+		l[at++] = m.data[i*n + i];
+	}
+	start[n] = at;
+
+	for(size_t i = 0; i < n; i++){
+		for(size_t e = start[i]; e < start[i+1]; e++){
+			size_t j = col[e];
+			double a = l[e] - ichol_dot(l, col, start[i], e, start[j], start[j+1], j);
+			if(j < i){
+				l[e] = a / l[start[j+1] - 1];
+			} else if(a > 0){
+				l[e] = sqrt(a);
+			} else {
+				printf("ERROR: Incomplete Cholesky broke down at row %zu, using Jacobi instead.\n", i);
+				free(index);
+				free(l);
+				return cmx_precond_jacobi(m);
+			}
+		}
+	}
+	p.type = 'c';
+	p.data = l;
+	p.index = index;
+	return p;
+}
+
+/*
+ * Applies the preconditioner, z = M^-1 r
+ * cmx_precond_t p - The preconditioner
+ * const double *r - The vector to precondition, n long
+ * double *z - Where to put the result, n long. Must not alias r
+ */
+void cmx_precond_apply(cmx_precond_t p, const double *r, double *z){
+	size_t n = p.n;
+	if(p.type == 'j'){
+		#pragma omp parallel for if(n >= CMX_PARALLEL_THRESHOLD)
+		for(size_t i = 0; i < n; i++)
+			z[i] = r[i] * p.data[i];
+	} else if(p.type == 'c'){
+		const double *l = p.data;
+		const size_t *start = p.index, *col = p.index + n + 1;
+		// Forward, L y = r
+		for(size_t i = 0; i < n; i++){
+			size_t d = start[i+1] - 1;
+			double t = r[i];
+			for(size_t e = start[i]; e < d; e++)
+				t -= l[e] * z[col[e]];
+			z[i] = t / l[d];
+		}
+		// Backward, L^T z = y, a row of L at a time
+		for(size_t i = n; i-- > 0; ){
+			size_t d = start[i+1] - 1;
+			z[i] /= l[d];
+			for(size_t e = start[i]; e < d; e++)
+				z[col[e]] -= l[e] * z[i];
+		}
+	} else {
+		for(size_t i = 0; i < n; i++)
+			z[i] = r[i];
+	}
+}
+
+/*
+ * Destroys a preconditioner, freeing its data
+ * cmx_precond_t p - The preconditioner to destroy
+ */
+int cmx_precond_destroy(cmx_precond_t p){
+	free(p.data);
+	free(p.index);
+	return 0;
+}
+
+/*
+ * Checks the right hand side and guess are matching column vectors, and that x can be written in place
+ */
+static int iter_check(cmx_matrix_t b, cmx_matrix_t x, cmx_iter_opts_t *opts, const char *name){
+	if(b.columns != 1 || x.columns != 1 || b.rows != x.rows){
+		printf("Error: Size mismatch in %s with b %zux%zu and x %zux%zu. Make sure they are column vectors\n", name, b.rows, b.columns, x.rows, x.columns);
+		return 1;
+	}
+	if(cmx_shared(x)){
+		printf("Error: %s writes the solution into x, which is shared. Call cmx_detach first\n", name);
+		return 1;
+	}
+	if(opts->precond != NULL && opts->precond->type != 'n' && opts->precond->n != b.rows){
+		printf("Error: Preconditioner of size %zu given to %s for a system of size %zu\n", opts->precond->n, name, b.rows);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Preconditioned conjugate gradients, for symmetric positive-definite A
+ * cmx_matvec_f f - Computes y = A x. Use cmx_matvec with a pointer to a cmx_matrix_t for dense A
+ * void *ctx - Passed through to f
+ * cmx_matrix_t b - The right hand side, nx1
+ * cmx_matrix_t x - The initial guess, nx1, overwritten with the solution. Must not be shared
+ * cmx_iter_opts_t *opts - The solver options, or NULL for the defaults
+ * Returns 0 once converged, 1 otherwise
+ */
+int cmx_cg(cmx_matvec_f f, void *ctx, cmx_matrix_t b, cmx_matrix_t x, cmx_iter_opts_t *opts){
+	cmx_iter_opts_t defaults = cmx_iter_defaults();
+	if(opts == NULL) opts = &defaults;
+	if(iter_check(b, x, opts, "CG")) return 1;
+
+	size_t n = b.rows;
+	int precond = (opts->precond != NULL && opts->precond->type != 'n');
+	double *work = (double*)malloc(sizeof(double) * 4 * n);
+	double *r = work, *p = work + n, *q = work + 2*n;
+	double *z = precond? work + 3*n: r;
+
+	double bnorm = cmx_v_mag(b);
+	if(bnorm == 0) bnorm = 1;
+
+	(*f)(x.data, r, ctx);
+	double rr = vec_residual(b.data, r, n);
+	opts->iterations = 0;
+	opts->residual = sqrt(rr) / bnorm;
+	int status = 1;
+
+	if(opts->residual <= opts->tol){
+		free(work);
+		return 0;
+	}
+	if(precond) cmx_precond_apply(*(opts->precond), r, z);
+	for(size_t i = 0; i < n; i++)
+		p[i] = z[i];
+	double rz = vec_dot(r, z, n);
+
+	for(size_t it = 1; it <= opts->max_iter; it++){
+		(*f)(p, q, ctx);
+		double pq = vec_dot(p, q, n);
+		if(pq == 0) break;
+		double alpha = rz / pq;
+		rr = vec_step(x.data, p, r, q, alpha, n);
+
+		opts->iterations = it;
+		opts->residual = sqrt(rr) / bnorm;
+		if(opts->report != NULL) (*(opts->report))(it, opts->residual, opts->report_ctx);
+		if(opts->residual <= opts->tol){
+			status = 0;
+			break;
+		}
+
+		if(precond) cmx_precond_apply(*(opts->precond), r, z);
+		double rz_new = precond? vec_dot(r, z, n): rr;
+		vec_xpay(z, rz_new / rz, p, n);
+		rz = rz_new;
+	}
+	free(work);
+	return status;
+}
+
+/*
+ * Right preconditioned BiCGSTAB, for general square A
+ * cmx_matvec_f f - Computes y = A x. Use cmx_matvec with a pointer to a cmx_matrix_t for dense A
+ * void *ctx - Passed through to f
+ * cmx_matrix_t b - The right hand side, nx1
+ * cmx_matrix_t x - The initial guess, nx1, overwritten with the solution. Must not be shared
+ * cmx_iter_opts_t *opts - The solver options, or NULL for the defaults
+ * Returns 0 once converged, 1 otherwise, including on breakdown
+ */
+int cmx_bicgstab(cmx_matvec_f f, void *ctx, cmx_matrix_t b, cmx_matrix_t x, cmx_iter_opts_t *opts){
+	cmx_iter_opts_t defaults = cmx_iter_defaults();
+	if(opts == NULL) opts = &defaults;
+	if(iter_check(b, x, opts, "BiCGSTAB")) return 1;
+
+	size_t n = b.rows;
+	int precond = (opts->precond != NULL && opts->precond->type != 'n');
+	double *work = (double*)calloc(8 * n, sizeof(double));
+	double *r = work, *rhat = work + n, *p = work + 2*n, *v = work + 3*n;
+	double *s = work + 4*n, *t = work + 5*n;
+	double *phat = precond? work + 6*n: p;
+	double *shat = precond? work + 7*n: s;
+
+	double bnorm = cmx_v_mag(b);
+	if(bnorm == 0) bnorm = 1;
+
+	(*f)(x.data, r, ctx);
+	double rr = vec_residual(b.data, r, n);
+	for(size_t i = 0; i < n; i++)
+		rhat[i] = r[i];
+	opts->iterations = 0;
+	opts->residual = sqrt(rr) / bnorm;
+	if(opts->residual <= opts->tol){
+		free(work);
+		return 0;
+	}
+
+	double rho = 1, alpha = 1, omega = 1;
+	int status = 1;
+	for(size_t it = 1; it <= opts->max_iter; it++){
+		double rho_new = vec_dot(rhat, r, n);
+		if(rho_new == 0) break;
+		double beta = (rho_new / rho) * (alpha / omega);
+		rho = rho_new;
+
+		#pragma omp parallel for if(n >= CMX_PARALLEL_THRESHOLD)
+		for(size_t i = 0; i < n; i++)
+			p[i] = r[i] + beta * (p[i] - omega * v[i]);
+		if(precond) cmx_precond_apply(*(opts->precond), p, phat);
+		(*f)(phat, v, ctx);
+		double rv = vec_dot(rhat, v, n);
+		if(rv == 0) break;
+		alpha = rho / rv;
+
+		double ss = 0;
+		#pragma omp parallel for reduction(+:ss) if(n >= CMX_PARALLEL_THRESHOLD)
+		for(size_t i = 0; i < n; i++){
+			s[i] = r[i] - alpha * v[i];
+			ss += s[i] * s[i];
+		}
+
+		opts->iterations = it;
+		if(sqrt(ss) / bnorm <= opts->tol){
+			#pragma omp parallel for if(n >= CMX_PARALLEL_THRESHOLD)
+			for(size_t i = 0; i < n; i++)
+				x.data[i] += alpha * phat[i];
+			opts->residual = sqrt(ss) / bnorm;
+			if(opts->report != NULL) (*(opts->report))(it, opts->residual, opts->report_ctx);
+			status = 0;
+			break;
+		}
+
+		if(precond) cmx_precond_apply(*(opts->precond), s, shat);
+		(*f)(shat, t, ctx);
+		double ts = 0, tt = 0;
+		#pragma omp parallel for reduction(+:ts,tt) if(n >= CMX_PARALLEL_THRESHOLD)
+		for(size_t i = 0; i < n; i++){
+			ts += t[i] * s[i];
+			tt += t[i] * t[i];
+		}
+		if(tt == 0) break;
+		omega = ts / tt;
+
+		rr = 0;
+		#pragma omp parallel for reduction(+:rr) if(n >= CMX_PARALLEL_THRESHOLD)
+		for(size_t i = 0; i < n; i++){
+			x.data[i] += alpha * phat[i] + omega * shat[i];
+			r[i] = s[i] - omega * t[i];
+			rr += r[i] * r[i];
+		}
+
+		opts->residual = sqrt(rr) / bnorm;
+		if(opts->report != NULL) (*(opts->report))(it, opts->residual, opts->report_ctx);
+		if(opts->residual <= opts->tol){
+			status = 0;
+			break;
+		}
+		if(omega == 0) break;
+	}
+	free(work);
+	return status;
+}
+
+/*
+ * Restarted GMRES with right preconditioning, for general square A
+ * Each inner step orthogonalises against the basis twice with cmx_gemm, and the
+ * residual comes from the Givens rotated Hessenberg matrix, so no extra products are needed
+ * cmx_matvec_f f - Computes y = A x. Use cmx_matvec with a pointer to a cmx_matrix_t for dense A
+ * void *ctx - Passed through to f
+ * cmx_matrix_t b - The right hand side, nx1
+ * cmx_matrix_t x - The initial guess, nx1, overwritten with the solution. Must not be shared
+ * cmx_iter_opts_t *opts - The solver options, or NULL for the defaults
+ * Returns 0 once converged, 1 otherwise
+ */
+int cmx_gmres(cmx_matvec_f f, void *ctx, cmx_matrix_t b, cmx_matrix_t x, cmx_iter_opts_t *opts){
+	cmx_iter_opts_t defaults = cmx_iter_defaults();
+	if(opts == NULL) opts = &defaults;
+	if(iter_check(b, x, opts, "GMRES")) return 1;
+
+	size_t n = b.rows;
+	size_t m = opts->restart;
+	if(m == 0 || m > n) m = n;
+	int precond = (opts->precond != NULL && opts->precond->type != 'n');
+
+	double *V = (double*)malloc(sizeof(double) * (m+1) * n);
+	double *H = (double*)malloc(sizeof(double) * (m+1) * m);
+	double *work = (double*)malloc(sizeof(double) * (2*n + 5*m + 2));
+	double *u = work, *z = work + n;
+	double *cs = work + 2*n, *sn = cs + m, *g = sn + m, *h = g + m + 1, *y = h + m + 1;
+
+	double bnorm = cmx_v_mag(b);
+	if(bnorm == 0) bnorm = 1;
+
+	size_t it = 0;
+	int status = 1;
+	opts->iterations = 0;
+	while(1){
+		(*f)(x.data, V, ctx);
+		double beta = sqrt(vec_residual(b.data, V, n));
+		opts->residual = beta / bnorm;
+		if(opts->residual <= opts->tol){
+			status = 0;
+			break;
+		}
+		if(it >= opts->max_iter) break;
+
+		for(size_t i = 0; i < n; i++)
+			V[i] /= beta;
+		g[0] = beta;
+		for(size_t i = 1; i <= m; i++)
+			g[i] = 0;
+
+		size_t k = 0;
+		while(k < m && it < opts->max_iter){
+			double *vk = V + k*n, *w = V + (k+1)*n;
+			if(precond){
+				cmx_precond_apply(*(opts->precond), vk, u);
+				(*f)(u, w, ctx);
+			} else {
+				(*f)(vk, w, ctx);
+			}
+
+			for(size_t i = 0; i <= k; i++)
+				H[i*m + k] = 0;
+			for(int pass = 0; pass < 2; pass++){
+				cmx_gemm('n', 't', k+1, 1, n, 1.0, V, n, w, n, 0.0, h, 1);
+				cmx_gemm('t', 'n', n, 1, k+1, -1.0, V, n, h, 1, 1.0, w, 1);
+				for(size_t i = 0; i <= k; i++)
+					H[i*m + k] += h[i];
+			}
+			double hk = sqrt(vec_dot(w, w, n));
+			if(hk != 0)
+				for(size_t i = 0; i < n; i++)
+					w[i] /= hk;
+
+			// Rotate the new column, then zero its subdiagonal
+			for(size_t i = 0; i < k; i++){
+				double a = H[i*m + k], c = H[(i+1)*m + k];
+				H[i*m + k] = cs[i] * a + sn[i] * c;
+				H[(i+1)*m + k] = -sn[i] * a + cs[i] * c;
+			}
+			double a = H[k*m + k];
+			double r = hypot(a, hk);
+			cs[k] = (r == 0)? 1: a / r;
+			sn[k] = (r == 0)? 0: hk / r;
+			H[k*m + k] = r;
+			g[k+1] = -sn[k] * g[k];
+			g[k] = cs[k] * g[k];
+
+			k++;
+			it++;
+			opts->iterations = it;
+			opts->residual = fabs(g[k]) / bnorm;
+			if(opts->report != NULL) (*(opts->report))(it, opts->residual, opts->report_ctx);
+			if(opts->residual <= opts->tol || hk == 0) break;
+		}
+
+		// Back substitute for y, then x += M^-1 V y
+		for(size_t i = k; i-- > 0; ){
+			double t = g[i];
+			for(size_t j = i+1; j < k; j++)
+				t -= H[i*m + j] * y[j];
+			y[i] = (H[i*m + i] == 0)? 0: t / H[i*m + i];
+		}
+		cmx_gemm('t', 'n', n, 1, k, 1.0, V, n, y, 1, 0.0, u, 1);
+		if(precond) cmx_precond_apply(*(opts->precond), u, z);
+		double *dx = precond? z: u;
+		for(size_t i = 0; i < n; i++)
+			x.data[i] += dx[i];
+
+		if(opts->residual <= opts->tol){
+			status = 0;
+			break;
+		}
+		if(it >= opts->max_iter) break;
+	}
+	free(V);
+	free(H);
+	free(work);
+	return status;
+}
@@ -0,0 +1,438 @@
+#include <string.h>
+#include <cmx_lu.h>
+
+/*
+ * Factors the panel of columns [k0, k1) from row k0 down, with partial pivoting
+ * Whole rows are swapped, so earlier columns of L and the columns right of the panel follow the pivots
+ * double *a - The nxn array being factored
+ */
+static void lu_panel(double *a, size_t n, size_t k0, size_t k1, size_t *pivot, int *sign, int *singular){
+	for(size_t j = k0; j < k1; j++){
+		size_t p = j;
+		double best = fabs(a[j*n + j]);
+		for(size_t i = j+1; i < n; i++)
+			if(fabs(a[i*n + j]) > best){
+				best = fabs(a[i*n + j]);
+				p = i;
+			}
+		pivot[j] = p;
+		if(p != j){
+			double *x = a + j*n, *y = a + p*n;
+			for(size_t c = 0; c < n; c++){
+				double t = x[c];
+				x[c] = y[c];
+				y[c] = t;
+			}
+			*sign = -*sign;
+		}
+
+		double d = a[j*n + j];
+		if(d == 0){
+			*singular = 1;
+			continue;
+		}
+		const double *aj = a + j*n;
+		#pragma omp parallel for if((n-j)*(k1-j) >= CMX_PARALLEL_THRESHOLD)
+		for(size_t i = j+1; i < n; i++){
+			double *ai = a + i*n;
+			double l = ai[j] / d;
+			ai[j] = l;
+			if(l != 0)
+				for(size_t c = j+1; c < k1; c++)
+					ai[c] -= l * aj[c];
+		}
+	}
+}
+
+/*
+ * Produces the LU factorisation of a square matrix with partial pivoting, P m = L U
+ * Blocked and right-looking: each panel of CMX_LU_BLOCK columns is factored,
+ * then the trailing matrix is updated with cmx_gemm
+ * A singular matrix is still factored, with singular set in the result
+ * cmx_matrix_t m - The matrix to factor. Left unchanged
+ * Free the result with cmx_lu_destroy
+ */
+cmx_lu_t cmx_lu(cmx_matrix_t m){
+	cmx_lu_t f = {m, NULL, 1, 0};
+	if(m.rows != m.columns){
+		printf("ERROR: cannot find LU factors of %zux%zu matrix. Matrix not square.\n", m.rows, m.columns);
+		f.lu = cmx_make(0, 0);
+		f.singular = 1;
+		return f;
+	}
+	size_t n = m.rows;
+	f.lu = cmx_detach(cmx_copy(m));
+	f.pivot = (size_t*)malloc(sizeof(size_t) * (n + 1));
+	double *a = f.lu.data;
+
+	for(size_t k0 = 0; k0 < n; k0 += CMX_LU_BLOCK){
+		size_t k1 = (k0 + CMX_LU_BLOCK < n)? k0 + CMX_LU_BLOCK: n;
+		lu_panel(a, n, k0, k1, f.pivot, &f.sign, &f.singular);
+		if(k1 == n)
+			break;
+
+		// Block row of U right of the panel, U12 = L11^-1 A12, split into column blocks
+		#pragma omp parallel for schedule(dynamic) if((k1-k0)*(k1-k0)*(n-k1) >= CMX_PARALLEL_THRESHOLD)
+		for(size_t c0 = k1; c0 < n; c0 += CMX_LU_BLOCK){
+			size_t c1 = (c0 + CMX_LU_BLOCK < n)? c0 + CMX_LU_BLOCK: n;
+			for(size_t i = k0+1; i < k1; i++){
+				double *ai = a + i*n;
+				for(size_t p = k0; p < i; p++){
+					double l = ai[p];
+					const double *ap = a + p*n;
+					for(size_t c = c0; c < c1; c++)
+						ai[c] -= l * ap[c];
+				}
+			}
+		}
+
+		// Trailing matrix, A22 -= L21 U12
+		cmx_gemm('n', 'n', n-k1, n-k1, k1-k0,
+				-1.0, a + k1*n + k0, n, a + k0*n + k1, n,
+				1.0, a + k1*n + k1, n);
+	}
+	return f;
+}
+
+/*
+ * Frees the factors from cmx_lu
+ */
+void cmx_lu_destroy(cmx_lu_t f){
+	cmx_destroy(f.lu);
+	free(f.pivot);
+}
+
+/*
+ * Solves A X = B for X, given the LU factors of A
+ * Forward then backward substitution, blocked so the bulk of the work is in cmx_gemm
+ * cmx_lu_t f - The factors of A, from cmx_lu
+ * cmx_matrix_t B - The right hand sides, one per column
+ * Produces a new matrix the same size as B, or a new 0x0 matrix if the sizes differ or A is singular
+ */
+cmx_matrix_t cmx_lu_solve(cmx_lu_t f, cmx_matrix_t B){
+	if(f.lu.rows != B.rows){
+		printf("ERROR: Size mismatch solving with LU factors %zux%zu and right hand side %zux%zu\n", f.lu.rows, f.lu.columns, B.rows, B.columns);
+		return cmx_make(0, 0);
+	}
+	if(f.singular){
+		printf("ERROR: Matrix is singular, cannot solve with its LU factors.\n");
+		return cmx_make(0, 0);
+	}
+	size_t n = f.lu.rows, k = B.columns;
+	cmx_matrix_t X = cmx_detach(cmx_copy(B));
+	double *l = f.lu.data, *x = X.data;
+
+	for(size_t i = 0; i < n; i++)
+		if(f.pivot[i] != i){
+			double *xi = x + i*k, *xp = x + f.pivot[i]*k;
+			for(size_t j = 0; j < k; j++){
+				double t = xi[j];
+				xi[j] = xp[j];
+				xp[j] = t;
+			}
+		}
+
+	// Forward substitution, L Y = P B, with the unit diagonal of L
+	for(size_t i0 = 0; i0 < n; i0 += CMX_LU_BLOCK){
+		size_t i1 = (i0 + CMX_LU_BLOCK < n)? i0 + CMX_LU_BLOCK: n;
+		cmx_gemm('n', 'n', i1-i0, k, i0,
+				-1.0, l + i0*n, n, x, k, 1.0, x + i0*k, k);
+		for(size_t i = i0; i < i1; i++){
+			double *xi = x + i*k;
+			for(size_t p = i0; p < i; p++){
+				double s = l[i*n + p];
+				double *xp = x + p*k;
+				for(size_t j = 0; j < k; j++)
+					xi[j] -= s * xp[j];
+			}
+		}
+	}
+
+	// Backward substitution, U X = Y
+	for(size_t i1 = n; i1 > 0; ){
+		size_t i0 = (i1 > CMX_LU_BLOCK)? i1 - CMX_LU_BLOCK: 0;
+		cmx_gemm('n', 'n', i1-i0, k, n-i1,
+				-1.0, l + i0*n + i1, n, x + i1*k, k, 1.0, x + i0*k, k);
+		for(size_t i = i1; i-- > i0; ){
+			double *xi = x + i*k;
+			for(size_t p = i+1; p < i1; p++){
+				double s = l[i*n + p];
+				double *xp = x + p*k;
+				for(size_t j = 0; j < k; j++)
+					xi[j] -= s * xp[j];
+			}
+			double d = l[i*n + i];
+			for(size_t j = 0; j < k; j++)
+				xi[j] /= d;
+		}
+		i1 = i0;
+	}
+	return X;
+}
+
+/*
+ * Produces the inverse of A given its LU factors, or a new 0x0 matrix if A is singular
+ * cmx_lu_t f - The factors of A, from cmx_lu
+ */
+cmx_matrix_t cmx_lu_inverse(cmx_lu_t f){
+	size_t n = f.lu.rows;
+	cmx_matrix_t I = cmx_make(n, n);
+	for(size_t i = 0; i < n; i++)
+		I.data[i*n + i] = 1.0;
+	cmx_matrix_t inverse = cmx_lu_solve(f, I);
+	cmx_destroy(I);
+	return inverse;
+}
+
+/*
+ * Gets the determinant of A given its LU factors
+ * cmx_lu_t f - The factors of A, from cmx_lu
+ */
+double cmx_lu_det(cmx_lu_t f){
+	double d = f.sign;
+	for(size_t i = 0; i < f.lu.rows; i++)
+		d *= f.lu.data[i*f.lu.columns + i];
+	return d;
+}
+
+/*
+ * Gets the natural log of the absolute value of the determinant of A given its LU factors
+ * Does not overflow where cmx_lu_det would
+ * cmx_lu_t f - The factors of A, from cmx_lu
+ * int *sign - Set to the sign of the determinant, 0 if A is singular. May be NULL
+ */
+double cmx_lu_logdet(cmx_lu_t f, int *sign){
+	int s = f.sign;
+	double d = 0;
+	for(size_t i = 0; i < f.lu.rows; i++){
+		double u = f.lu.data[i*f.lu.columns + i];
+		if(u < 0)
+			s = -s;
+		d += log(fabs(u));
+	}
+	if(f.singular)
+		s = 0;
+	if(sign != NULL)
+		*sign = s;
+	return d;
+}
+
+/*
+ * Makes an updatable inverse of a square, non-singular matrix
+ * cmx_matrix_t a - The matrix. Shared with the result until either is changed
+ * size_t refactor - Rank of changes to apply between recomputing the inverse from scratch.
+ *		0 uses CMX_UPDINV_REFACTOR, SIZE_MAX never refactors
+ * Returns NULL if a is singular. Free the result with cmx_updinv_destroy
+ */
+cmx_updinv_t* cmx_updinv_make(cmx_matrix_t a, size_t refactor){
+	if(a.rows != a.columns){
+		printf("ERROR: cannot make updatable inverse of %zux%zu matrix. Matrix not square.\n", a.rows, a.columns);
+		return NULL;
+	}
+	cmx_updinv_t *u = (cmx_updinv_t*)malloc(sizeof(cmx_updinv_t));
+	u->a = cmx_copy(a);
+	u->inverse = cmx_make(0, 0);
+	u->refactor = (refactor == 0)? CMX_UPDINV_REFACTOR: refactor;
+	if(cmx_updinv_refactor(u)){
+		cmx_updinv_destroy(u);
+		return NULL;
+	}
+	return u;
+}
+
+/*
+ * Recomputes the inverse and determinant from the matrix, clearing the rounding error of earlier changes
+ * Called by the update functions once refactor worth of rank has been applied
+ * Returns non-zero, leaving the inverse as it was, if the matrix is singular
+ */
+int cmx_updinv_refactor(cmx_updinv_t *u){
+	cmx_lu_t f = cmx_lu(u->a);
+	if(f.singular){
+		printf("ERROR: Matrix is singular, cannot refactor its inverse.\n");
+		cmx_lu_destroy(f);
+		return 1;
+	}
+	cmx_destroy(u->inverse);
+	u->inverse = cmx_lu_inverse(f);
+	u->logdet = cmx_lu_logdet(f, &u->sign);
+	u->rank = 0;
+	cmx_lu_destroy(f);
+	return 0;
+}
+
+/*
+ * Counts rank against the refactoring budget, refactoring when it runs out
+ */
+static void updinv_applied(cmx_updinv_t *u, size_t k){
+	u->rank += k;
+	if(u->rank >= u->refactor)
+		cmx_updinv_refactor(u);
+}
+
+/*
+ * Applies a rank-1 change to the inverse, inverse -= z y^T / s, and to the determinant, det *= s
+ * z and y are A^-1 u and v^T A^-1 for the change A + u v^T, and s = 1 + v^T A^-1 u
+ */
+static void updinv_rank1(cmx_updinv_t *u, const double *z, const double *y, double s){
+	size_t n = u->a.rows;
+	u->inverse = cmx_detach(u->inverse);
+	double *inv = u->inverse.data;
+	#pragma omp parallel for if(n*n >= CMX_PARALLEL_THRESHOLD)
+	for(size_t i = 0; i < n; i++){
+		double zi = z[i] / s;
+		if(zi == 0) continue;
+		double *row = inv + i*n;
+		for(size_t j = 0; j < n; j++)
+			row[j] -= zi * y[j];
+	}
+	u->logdet += log(fabs(s));
+	if(s < 0)
+		u->sign = -u->sign;
+}
+
+/*
+ * Changes the matrix to A + U V^T in O(n^2 k), updating the inverse by Sherman-Morrison-Woodbury
+ * (A + U V^T)^-1 = A^-1 - A^-1 U S^-1 V^T A^-1, where S = I + V^T A^-1 U,
+ * and the determinant by the matrix determinant lemma, det(A + U V^T) = det(S) det(A)
+ * cmx_matrix_t U, V - nxk matrices. Left unchanged
+ * Returns non-zero, leaving everything unchanged, if the result would be singular
+ */
+int cmx_updinv_update(cmx_updinv_t *u, cmx_matrix_t U, cmx_matrix_t V){
+	size_t n = u->a.rows, k = U.columns;
+	if(U.rows != n || V.rows != n || V.columns != k){
+		printf("ERROR: Size mismatch updating %zux%zu inverse with %zux%zu and %zux%zu. Both must be nxk\n", n, n, U.rows, U.columns, V.rows, V.columns);
+		return 1;
+	}
+	if(k == 0)
+		return 0;
+
+	cmx_matrix_t Z = cmx_make(n, k), Y = cmx_make(k, n), S = cmx_make(k, k);
+	double *inv = u->inverse.data;
+	cmx_gemm('n', 'n', n, k, n, 1.0, inv, n, U.data, k, 0.0, Z.data, k);
+	cmx_gemm('t', 'n', k, n, n, 1.0, V.data, k, inv, n, 0.0, Y.data, n);
+	cmx_gemm('t', 'n', k, k, n, 1.0, V.data, k, Z.data, k, 0.0, S.data, k);
+	for(size_t i = 0; i < k; i++)
+		S.data[i*k + i] += 1.0;
+
+	cmx_lu_t f = cmx_lu(S);
+	int result = f.singular;
+	if(result)
+		printf("ERROR: Update would make the matrix singular, leaving it unchanged.\n");
+	else{
+		int sign;
+		cmx_matrix_t W = cmx_lu_solve(f, Y);
+		u->inverse = cmx_detach(u->inverse);
+		cmx_gemm('n', 'n', n, n, k, -1.0, Z.data, k, W.data, n, 1.0, u->inverse.data, n);
+		u->logdet += cmx_lu_logdet(f, &sign);
+		u->sign *= sign;
+
+		u->a = cmx_detach(u->a);
+		cmx_gemm('n', 't', n, n, k, 1.0, U.data, k, V.data, k, 1.0, u->a.data, n);
+		cmx_destroy(W);
+	}
+	cmx_lu_destroy(f);
+	cmx_destroy(Z);
+	cmx_destroy(Y);
+	cmx_destroy(S);
+
+	if(!result)
+		updinv_applied(u, k);
+	return result;
+}
+
+/*
+ * Sets one element of the matrix in O(n^2), a rank-1 change of the element's old value
+ * double val - The new value
+ * size_t r, c - Row and column of the element
+ * Returns non-zero, leaving everything unchanged, if the result would be singular
+ */
+int cmx_updinv_put(cmx_updinv_t *u, double val, size_t r, size_t c){
+	size_t n = u->a.rows;
+	if(r >= n || c >= n){
+		printf("ERROR: Element (%zu, %zu) is outside the %zux%zu matrix.\n", r, c, n, n);
+		return 1;
+	}
+	double delta = val - u->a.data[r*n + c];
+	if(delta == 0)
+		return 0;
+
+	// u = delta e_r and v = e_c, so z is column r of the inverse and y is row c
+	double *inv = u->inverse.data;
+	double s = 1 + delta * inv[c*n + r];
+	if(s == 0){
+		printf("ERROR: Update would make the matrix singular, leaving it unchanged.\n");
+		return 1;
+	}
+	double *z = (double*)malloc(sizeof(double) * 2 * n);
+	double *y = z + n;
+	for(size_t i = 0; i < n; i++){
+		z[i] = delta * inv[i*n + r];
+		y[i] = inv[c*n + i];
+	}
+	updinv_rank1(u, z, y, s);
+	free(z);
+
+	u->a = cmx_put(u->a, val, r, c);
+	updinv_applied(u, 1);
+	return 0;
+}
+
+/*
+ * Replaces one row of the matrix in O(n^2), a rank-1 change by the difference from the old row
+ * cmx_matrix_t row - The new row, 1xn or nx1. Left unchanged
+ * size_t r - The row to replace
+ * Returns non-zero, leaving everything unchanged, if the result would be singular
+ */
+int cmx_updinv_putr(cmx_updinv_t *u, cmx_matrix_t row, size_t r){
+	size_t n = u->a.rows;
+	if(r >= n || row.rows*row.columns != n || (row.rows != 1 && row.columns != 1)){
+		printf("ERROR: Cannot put %zux%zu row at row %zu of %zux%zu matrix.\n", row.rows, row.columns, r, n, n);
+		return 1;
+	}
+
+	// u = e_r and v is the change in the row, so z is column r of the inverse
+	double *inv = u->inverse.data;
+	double *z = (double*)malloc(sizeof(double) * 3 * n);
+	double *y = z + n, *v = y + n;
+	for(size_t i = 0; i < n; i++){
+		z[i] = inv[i*n + r];
+		v[i] = row.data[i] - u->a.data[r*n + i];
+	}
+	cmx_gemm('n', 'n', 1, n, n, 1.0, v, n, inv, n, 0.0, y, n);
+	double s = 1 + y[r];
+	if(s == 0){
+		printf("ERROR: Update would make the matrix singular, leaving it unchanged.\n");
+		free(z);
+		return 1;
+	}
+	updinv_rank1(u, z, y, s);
+	free(z);
+
+	u->a = cmx_detach(u->a);
+	memcpy(u->a.data + r*n, row.data, sizeof(double) * n);
+	updinv_applied(u, 1);
+	return 0;
+}
+
+/*
+ * Gets the current inverse. Sharing makes this O(1), destroy the result after use
+ */
+cmx_matrix_t cmx_updinv_inverse(cmx_updinv_t *u){
+	return cmx_copy(u->inverse);
+}
+
+/*
+ * Gets the determinant of the current matrix
+ */
+double cmx_updinv_det(cmx_updinv_t *u){
+	return u->sign * exp(u->logdet);
+}
+
+/*
+ * Frees an updatable inverse
+ */
+void cmx_updinv_destroy(cmx_updinv_t *u){
+	cmx_destroy(u->a);
+	cmx_destroy(u->inverse);
+	free(u);
+}
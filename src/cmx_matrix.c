@@ -1,4 +1,6 @@
 #include <cmx_matrix.h>
+#include <cmx_lu.h>
+#include <cmx_packed.h>
 
 /*
  *	Create a new matrix given an array and the size the matrix should be
@@ -15,31 +17,50 @@ cmx_matrix_t cmx_init(double *data, size_t r, size_t c){
 
 /*
  *	Create a new matrix give the number of rows and columns. Initialises all entries with 0;
+ *	The data has a reference count of 1 stored just in front of it
+ *	If the memory cannot be had, prints why and returns a 0x0 matrix with no data
  *	size_t r - The number of rows in the matrix
  *	size_t c - The number of columns in the matrix
  */
 cmx_matrix_t cmx_make(size_t r, size_t c){
-	double *data = (double*)malloc(sizeof(double) * r * c);
+	char *block = (char*)malloc(CMX_BUFFER_HEADER + sizeof(double) * r * c);
+	if(block == NULL){
+		printf("ERROR: Out of memory making %zux%zu matrix.\n", r, c);
+		cmx_matrix_t empty = {NULL, 0, 0, NULL};
+		return empty;
+	}
+	atomic_size_t *refs = (atomic_size_t*)block;
+	atomic_init(refs, 1);
+	double *data = (double*)(block + CMX_BUFFER_HEADER);
 	for(size_t i = 0; i < r*c; i++)
 		data[i] = 0.0;
-	cmx_matrix_t matrix = {data, r, c};
+	cmx_matrix_t matrix = {data, r, c, refs};
 	return matrix;
 }
 
 /*
- * Destroys a given matrix, freeing the data used by the matrix
+ * Releases a given matrix, freeing the data once no other copy shares it
  * cmx_matrix_t *matrix - The matrix to be destroyed
  */
 int cmx_destroy(cmx_matrix_t matrix){
-	free(matrix.data);
+	if(matrix.refs == NULL)
+		free(matrix.data);
+	else if(atomic_fetch_sub(matrix.refs, 1) == 1)
+		free(matrix.refs);
 	return 0;
 }
 
 /*
- * Makes a duplicate of the matrix with separate data pointer, but contaisn the same values as when copied
+ * Makes a duplicate of the matrix in O(1). Both share the data until either is changed,
+ * at which point the one being changed gets its own copy
+ * Matrices whose data was not made by cmx_make are copied straight away
  * cmx_matrix_t m - The matrix to be duplicated
  */
 cmx_matrix_t cmx_copy(cmx_matrix_t m){
+	if(m.refs != NULL){
+		atomic_fetch_add(m.refs, 1);
+		return m;
+	}
 	cmx_matrix_t m2 = cmx_make(m.rows, m.columns);
 	for(size_t i = 0; i < m.rows*m.columns; i++)
 		m2.data[i] = m.data[i];
@@ -47,6 +68,28 @@ cmx_matrix_t cmx_copy(cmx_matrix_t m){
 
 }
 
+/*
+ * Gives the matrix data of its own, copying it only if it is shared. Called before any write
+ * cmx_matrix_t m - The matrix about to be changed. Released if a copy was made
+ */
+cmx_matrix_t cmx_detach(cmx_matrix_t m){
+	if(!cmx_shared(m))
+		return m;
+	cmx_matrix_t m2 = cmx_make(m.rows, m.columns);
+	for(size_t i = 0; i < m.rows*m.columns; i++)
+		m2.data[i] = m.data[i];
+	cmx_destroy(m);
+	return m2;
+}
+
+/*
+ * Checks whether another copy shares the matrix's data
+ * cmx_matrix_t m - The matrix to check
+ */
+int cmx_shared(cmx_matrix_t m){
+	return m.refs != NULL && atomic_load(m.refs) > 1;
+}
+
 /*
  * Gets the identity matrix of a certain size, n
  * size_t n - The size of the matrix
@@ -70,6 +113,7 @@ cmx_matrix_t cmx_add(cmx_matrix_t m1, cmx_matrix_t m2){
 		printf("ERROR: Matrix size mismatch when adding, have a %d,%d and %d,%d\n", m1.rows, m1.columns, m2.rows, m2.columns);
 		return m1;
 	}
+	m1 = cmx_detach(m1);
 	for(size_t i = 0; i < m1.rows*m1.columns; i++)
 		m1.data[i] += m2.data[i];
 
@@ -83,9 +127,13 @@ cmx_matrix_t cmx_add(cmx_matrix_t m1, cmx_matrix_t m2){
  * Replaces data in cmx_matrix_t m1 with the result, leaves cmx_matrix_t m2 unchanged
  */
 cmx_matrix_t cmx_sub(cmx_matrix_t m1, cmx_matrix_t m2){
-	cmx_matrix_t m3 = cmx_copy(m2);
-	cmx_add(m1, cmx_scalar(m3, -1));
-	cmx_destroy(m3);
+	if(m1.rows != m2.rows || m1.columns != m2.columns){
+		printf("ERROR: Matrix size mismatch when subtracting, have a %zu,%zu and %zu,%zu\n", m1.rows, m1.columns, m2.rows, m2.columns);
+		return m1;
+	}
+	m1 = cmx_detach(m1);
+	for(size_t i = 0; i < m1.rows*m1.columns; i++)
+		m1.data[i] -= m2.data[i];
 	return m1;
 }
 
@@ -96,6 +144,7 @@ cmx_matrix_t cmx_sub(cmx_matrix_t m1, cmx_matrix_t m2){
  * Overwrites matrix data with results data
  */
 cmx_matrix_t cmx_scalar(cmx_matrix_t m, double s){
+	m = cmx_detach(m);
 	for(size_t i = 0; i < m.rows*m.columns; i++)
 		m.data[i] *= s;
 	return m;
@@ -108,6 +157,7 @@ cmx_matrix_t cmx_scalar(cmx_matrix_t m, double s){
  * Overwrites matrix data with results data
  */
 cmx_matrix_t cmx_func(cmx_matrix_t m, double(*f)(double)){
+	m = cmx_detach(m);
 	for(size_t i = 0; i < m.rows*m.columns; i++)
 		m.data[i] = (*f)(m.data[i]);
 	return m;
@@ -120,7 +170,7 @@ cmx_matrix_t cmx_func(cmx_matrix_t m, double(*f)(double)){
  * cmx_matrix_t m1 - The first vector to dot
  * cmx_matrix_t m2 - The second vector to dot
  */
-double v_dot(cmx_matrix_t m1, cmx_matrix_t m2){
+double cmx_v_dot(cmx_matrix_t m1, cmx_matrix_t m2){
 	if(m1.rows != m2.rows || m1.columns != m2.columns || m1.columns != 1){
 		printf("Error: Size mismatch when vector dot product with %dx%d and %dx%d. Make sure they are column vectors", m1.rows, m1.columns, m2.rows, m2.columns);
 		return 0;
@@ -139,7 +189,7 @@ double v_dot(cmx_matrix_t m1, cmx_matrix_t m2){
  * cmx_matrix_t m1 - The first vector to cross
  * cmx_matrix_t m2 - The second vector to cross
  */
-cmx_matrix_t v_cross(cmx_matrix_t m1, cmx_matrix_t m2){
+cmx_matrix_t cmx_v_cross(cmx_matrix_t m1, cmx_matrix_t m2){
 	if(m1.columns != m2.columns || m1.columns != 1 || m1.rows != m2.rows || m1.rows != 3){
 		printf("Error: Cannot cross product a %dx%d and %dx%d. Make sure they are 3D column vectors\n", m1.rows, m1.columns, m2.rows, m2.columns);
 		return m1;
@@ -170,7 +220,7 @@ cmx_matrix_t v_cross(cmx_matrix_t m1, cmx_matrix_t m2){
  * Vector must be in the form nx1
  * cmx_matrix_t m - The vector to find the magnitude of
  */
-double v_mag(cmx_matrix_t m){
+double cmx_v_mag(cmx_matrix_t m){
 	return cmx_rsqsum(m);
 }
 
@@ -181,6 +231,7 @@ double v_mag(cmx_matrix_t m){
  * double s - The scalar to multiply by
  */
 cmx_matrix_t cmx_eros_scalar(cmx_matrix_t m, size_t r, double s){
+	m = cmx_detach(m);
 	cmx_matrix_t row = cmx_getr(m, r);
 	cmx_scalar(row, s);
 	cmx_putr(m, row, r);
@@ -197,6 +248,7 @@ cmx_matrix_t cmx_eros_scalar(cmx_matrix_t m, size_t r, double s){
  * size_t j - The other row to swap
  */
 cmx_matrix_t cmx_eros_swap(cmx_matrix_t m, size_t i, size_t j){
+	m = cmx_detach(m);
 	cmx_matrix_t ri = cmx_getr(m, i);
 	cmx_matrix_t rj = cmx_getr(m, j);
 	cmx_putr(m, ri, j);
@@ -216,6 +268,7 @@ cmx_matrix_t cmx_eros_swap(cmx_matrix_t m, size_t i, size_t j){
  * size_t q - The source row
  */
 cmx_matrix_t cmx_eros_add(cmx_matrix_t m, size_t r, double s, size_t q){
+	m = cmx_detach(m);
 	cmx_matrix_t row = cmx_getr(m, q);
 	cmx_scalar(row, s);
 	cmx_matrix_t row2 = cmx_getr(m, r);
@@ -231,7 +284,7 @@ cmx_matrix_t cmx_eros_add(cmx_matrix_t m, size_t r, double s, size_t q){
  * Takes a matrix and produces a copy in reduced echelon form.
  */
 cmx_matrix_t cmx_ref(cmx_matrix_t mo){
-	cmx_matrix_t m = cmx_copy(mo);
+	cmx_matrix_t m = cmx_detach(cmx_copy(mo));
 	double ril, rji;
 	size_t rilp;
 
@@ -288,30 +341,488 @@ cmx_matrix_t cmx_rref(cmx_matrix_t m){
 	return m;
 }
 
+// Whether cmx_product may take the Strassen path, see cmx_set_strassen
+static int cmx_strassen_enabled = 1;
+
 /*
  * Matrix multiplies the matrices together in the order given
  * For example:
  * m3 = m1 m2
+ * Large products go through cmx_product_strassen unless turned off with cmx_set_strassen
  * cmx_matrix_t m1 - The first matrix. Transformation to apply
  * cmx_matrix_t m2 - The second matrix. Matrix to aply transformation to
  */
 cmx_matrix_t cmx_product(cmx_matrix_t m1, cmx_matrix_t m2){
+	if(cmx_strassen_enabled && m1.columns == m2.rows)
+		return cmx_product_strassen(m1, m2);
 	cmx_matrix_t m3 = cmx_make(m1.rows, m2.columns);
 	if(m1.columns != m2.rows){
 		printf("Size mismatch when multiplying matrices together. Given %dx%d and %dx%d\n", m1.rows, m1.columns, m2.rows, m2.columns);
 		return m3;
 	}
-	for(size_t i = 0; i < m2.columns; i++){
-		for(size_t j = 0; j < m1.rows; j++){
-			double t = 0;
-			for(size_t k = 0; k < m2.rows; k++)
-				t += cmx_get(m2, k, i) * cmx_get(m1, j, k);
-			cmx_put(m3, t, j, i);
-		}
+	if(m3.rows != m1.rows)
+		return m3;
+	cmx_gemm('n', 'n', m1.rows, m2.columns, m1.columns,
+			1.0, m1.data, m1.columns, m2.data, m2.columns, 0.0, m3.data, m3.columns);
+	return m3;
+}
+
+/*
+ * Turns the Strassen path of cmx_product on or off. It is on by default
+ * Strassen's error bound is normwise rather than per element, so callers whose results
+ * have entries far smaller than the inputs should turn it off. See cmx_product_strassen
+ * int on - Non-zero to allow Strassen, zero for the classical kernel only
+ */
+void cmx_set_strassen(int on){
+	cmx_strassen_enabled = on;
+}
+
+// Z = X + s Y on strided blocks
+static void strassen_add(size_t r, size_t c, const double *X, size_t ldx,
+		const double *Y, size_t ldy, double s, double *Z, size_t ldz){
+	#pragma omp parallel for if(r*c >= CMX_PARALLEL_THRESHOLD)
+	for(size_t i = 0; i < r; i++)
+		for(size_t j = 0; j < c; j++)
+			Z[i*ldz + j] = X[i*ldx + j] + s * Y[i*ldy + j];
+}
+
+// Z = s P, or Z += s P when acc is set, on strided blocks
+static void strassen_put(size_t r, size_t c, const double *P, size_t ldp,
+		double s, double *Z, size_t ldz, int acc){
+	#pragma omp parallel for if(r*c >= CMX_PARALLEL_THRESHOLD)
+	for(size_t i = 0; i < r; i++)
+		for(size_t j = 0; j < c; j++)
+			Z[i*ldz + j] = (acc? Z[i*ldz + j]: 0) + s * P[i*ldp + j];
+}
+
+// Doubles of workspace strassen_product needs for an mxk by kxn product
+static size_t strassen_workspace(size_t m, size_t k, size_t n){
+	if(m <= CMX_STRASSEN_CUTOFF || k <= CMX_STRASSEN_CUTOFF || n <= CMX_STRASSEN_CUTOFF)
+		return 0;
+	m /= 2; k /= 2; n /= 2;
+	return m*k + k*n + m*n + strassen_workspace(m, k, n);
+}
+
+/*
+ * Allocates ws doubles of Strassen workspace, or gives NULL if ws is 0 or the memory cannot be had
+ * Callers take the classical product when it is NULL, which needs none
+ */
+static double* strassen_alloc(size_t ws){
+	if(ws == 0)
+		return NULL;
+	double *w = (double*)malloc(sizeof(double) * ws);
+	if(w == NULL)
+		printf("ERROR: Out of memory for %zu doubles of Strassen workspace, using the classical product.\n", ws);
+	return w;
+}
+
+/*
+ * C = A B by Strassen's recursion on strided blocks
+ * An odd row or column is peeled off and handled by cmx_gemm, so any shape works
+ * double *w - Scratch space of at least strassen_workspace(m, k, n) doubles
+ */
+static void strassen_product(size_t m, size_t k, size_t n,
+		const double *A, size_t lda, const double *B, size_t ldb,
+		double *C, size_t ldc, double *w){
+	if(m <= CMX_STRASSEN_CUTOFF || k <= CMX_STRASSEN_CUTOFF || n <= CMX_STRASSEN_CUTOFF){
+		cmx_gemm('n', 'n', m, n, k, 1.0, A, lda, B, ldb, 0.0, C, ldc);
+		return;
+	}
+	size_t mh = m/2, kh = k/2, nh = n/2;
+	size_t me = 2*mh, ke = 2*kh, ne = 2*nh;
+
+	const double *A11 = A, *A12 = A + kh, *A21 = A + mh*lda, *A22 = A21 + kh;
+	const double *B11 = B, *B12 = B + nh, *B21 = B + kh*ldb, *B22 = B21 + nh;
+	double *C11 = C, *C12 = C + nh, *C21 = C + mh*ldc, *C22 = C21 + nh;
+	double *S = w, *T = S + mh*kh, *P = T + kh*nh, *wn = P + mh*nh;
+
+	// M1 = (A11 + A22)(B11 + B22), into C11 and C22
+	strassen_add(mh, kh, A11, lda, A22, lda, 1, S, kh);
+	strassen_add(kh, nh, B11, ldb, B22, ldb, 1, T, nh);
+	strassen_product(mh, kh, nh, S, kh, T, nh, P, nh, wn);
+	strassen_put(mh, nh, P, nh, 1, C11, ldc, 0);
+	strassen_put(mh, nh, P, nh, 1, C22, ldc, 0);
+
+	// M2 = (A21 + A22) B11, into C21 and out of C22
+	strassen_add(mh, kh, A21, lda, A22, lda, 1, S, kh);
+	strassen_product(mh, kh, nh, S, kh, B11, ldb, C21, ldc, wn);
+	strassen_put(mh, nh, C21, ldc, -1, C22, ldc, 1);
+
+	// M3 = A11 (B12 - B22), into C12 and C22
+	strassen_add(kh, nh, B12, ldb, B22, ldb, -1, T, nh);
+	strassen_product(mh, kh, nh, A11, lda, T, nh, C12, ldc, wn);
+	strassen_put(mh, nh, C12, ldc, 1, C22, ldc, 1);
+
+	// M4 = A22 (B21 - B11), into C11 and C21
+	strassen_add(kh, nh, B21, ldb, B11, ldb, -1, T, nh);
+	strassen_product(mh, kh, nh, A22, lda, T, nh, P, nh, wn);
+	strassen_put(mh, nh, P, nh, 1, C11, ldc, 1);
+	strassen_put(mh, nh, P, nh, 1, C21, ldc, 1);
+
+	// M5 = (A11 + A12) B22, out of C11 and into C12
+	strassen_add(mh, kh, A11, lda, A12, lda, 1, S, kh);
+	strassen_product(mh, kh, nh, S, kh, B22, ldb, P, nh, wn);
+	strassen_put(mh, nh, P, nh, -1, C11, ldc, 1);
+	strassen_put(mh, nh, P, nh, 1, C12, ldc, 1);
+
+	// M6 = (A21 - A11)(B11 + B12), into C22
+	strassen_add(mh, kh, A21, lda, A11, lda, -1, S, kh);
+	strassen_add(kh, nh, B11, ldb, B12, ldb, 1, T, nh);
+	strassen_product(mh, kh, nh, S, kh, T, nh, P, nh, wn);
+	strassen_put(mh, nh, P, nh, 1, C22, ldc, 1);
+
+	// M7 = (A12 - A22)(B21 + B22), into C11
+	strassen_add(mh, kh, A12, lda, A22, lda, -1, S, kh);
+	strassen_add(kh, nh, B21, ldb, B22, ldb, 1, T, nh);
+	strassen_product(mh, kh, nh, S, kh, T, nh, P, nh, wn);
+	strassen_put(mh, nh, P, nh, 1, C11, ldc, 1);
+
+	// Peel off the odd inner index, row and column
+	if(ke < k)
+		cmx_gemm('n', 'n', me, ne, 1, 1.0, A + ke, lda, B + ke*ldb, ldb, 1.0, C, ldc);
+	if(ne < n)
+		cmx_gemm('n', 'n', me, 1, k, 1.0, A, lda, B + ne, ldb, 0.0, C + ne, ldc);
+	if(me < m)
+		cmx_gemm('n', 'n', 1, n, k, 1.0, A + me*lda, lda, B, ldb, 0.0, C + me*ldc, ldc);
+}
+
+/*
+ * Matrix multiplies the matrices together with Strassen's algorithm, m3 = m1 m2
+ * Recurses on halves until a dimension is at most CMX_STRASSEN_CUTOFF, then uses cmx_gemm,
+ * whose threads carry the parallelism. Odd sizes are peeled, so any shape is accepted.
+ * Temporaries come from one workspace of about (rk + kc + rc)/3 doubles, allocated up front.
+ * If it cannot be had the classical kernel is used instead, which needs none.
+ * Error bound, with u the unit roundoff, n the largest dimension and n0 the cutoff:
+ *	max|C - fl(C)| <= [(n/n0)^log2(12) (n0^2 + 5 n0) - 5n] u max|A| max|B|
+ * against n u (|A||B|) per element for the classical kernel
+ * cmx_matrix_t m1 - The first matrix, rxk
+ * cmx_matrix_t m2 - The second matrix, kxc
+ */
+cmx_matrix_t cmx_product_strassen(cmx_matrix_t m1, cmx_matrix_t m2){
+	cmx_matrix_t m3 = cmx_make(m1.rows, m2.columns);
+	if(m1.columns != m2.rows){
+		printf("Size mismatch when multiplying matrices together. Given %zux%zu and %zux%zu\n", m1.rows, m1.columns, m2.rows, m2.columns);
+		return m3;
 	}
+	if(m3.rows != m1.rows)
+		return m3;
+	double *w = strassen_alloc(strassen_workspace(m1.rows, m1.columns, m2.columns));
+	if(w == NULL){
+		cmx_gemm('n', 'n', m1.rows, m2.columns, m1.columns,
+				1.0, m1.data, m1.columns, m2.data, m2.columns, 0.0, m3.data, m3.columns);
+		return m3;
+	}
+	strassen_product(m1.rows, m1.columns, m2.columns,
+			m1.data, m1.columns, m2.data, m2.columns, m3.data, m3.columns, w);
+	free(w);
 	return m3;
 }
 
+/*
+ * C = A B for nxn arrays, into memory the caller already has
+ * Takes the Strassen path whenever cmx_product would, given the workspace for it
+ * double *w - Scratch space of at least strassen_workspace(n, n, n) doubles, or NULL for the classical product
+ */
+static void square_product(size_t n, const double *A, const double *B, double *C, double *w){
+	if(cmx_strassen_enabled && w != NULL)
+		strassen_product(n, n, n, A, n, B, n, C, n, w);
+	else
+		cmx_gemm('n', 'n', n, n, n, 1.0, A, n, B, n, 0.0, C, n);
+}
+
+/*
+ * Raises a square matrix to an integer power by binary exponentiation, O(log k) products
+ * Bits of k are taken from the top, squaring and then multiplying by m where a bit is set,
+ * so every product goes between the same two buffers and nothing is allocated along the way
+ * cmx_matrix_t m - The matrix
+ * int k - The power. Negative powers invert m with its LU factors first, 0 gives the identity
+ * Produces a new matrix, or a new 0x0 matrix if m is not square, is singular with k < 0 or memory runs out
+ */
+cmx_matrix_t cmx_pow(cmx_matrix_t m, int k){
+	if(m.rows != m.columns){
+		printf("ERROR: cannot raise %zux%zu matrix to a power. Matrix not square.\n", m.rows, m.columns);
+		return cmx_make(0, 0);
+	}
+	size_t n = m.rows;
+	if(k == 0)
+		return cmx_getI(n);
+
+	cmx_matrix_t base = cmx_copy(m);
+	unsigned int e = (k < 0)? -(unsigned int)k: (unsigned int)k;
+	if(k < 0){
+		cmx_lu_t f = cmx_lu(m);
+		cmx_destroy(base);
+		base = f.singular? cmx_make(0, 0): cmx_lu_inverse(f);
+		cmx_lu_destroy(f);
+		if(base.rows != n){
+			printf("ERROR: Matrix is singular, cannot raise it to a negative power.\n");
+			cmx_destroy(base);
+			return cmx_make(0, 0);
+		}
+	}
+	if(e == 1)
+		return base;
+
+	cmx_matrix_t X = cmx_make(n, n), Y = cmx_make(n, n);
+	if(X.rows != n || Y.rows != n){
+		cmx_destroy(X);
+		cmx_destroy(Y);
+		cmx_destroy(base);
+		return cmx_make(0, 0);
+	}
+	for(size_t i = 0; i < n*n; i++)
+		X.data[i] = base.data[i];
+	double *w = cmx_strassen_enabled? strassen_alloc(strassen_workspace(n, n, n)): NULL;
+
+	int bit = 0;
+	while((e >> bit) > 1)
+		bit++;
+	while(bit-- > 0){
+		square_product(n, X.data, X.data, Y.data, w);
+		cmx_matrix_t t = X; X = Y; Y = t;
+		if((e >> bit) & 1){
+			square_product(n, X.data, base.data, Y.data, w);
+			t = X; X = Y; Y = t;
+		}
+	}
+
+	free(w);
+	cmx_destroy(Y);
+	cmx_destroy(base);
+	return X;
+}
+
+// Largest 1-norm each Pade degree handles to double precision, from Higham (2005)
+static const double expm_theta[] = {1.495585217958292e-2, 2.539398330063230e-1,
+		9.504178996162932e-1, 2.097847961257068e0, 5.371920351148152e0};
+static const int expm_degree[] = {3, 5, 7, 9, 13};
+
+// Pade numerator coefficients for each degree, lowest power first
+static const double expm_b3[] = {120, 60, 12, 1};
+static const double expm_b5[] = {30240, 15120, 3360, 420, 30, 1};
+static const double expm_b7[] = {17297280, 8648640, 1995840, 277200, 25200, 1512, 56, 1};
+static const double expm_b9[] = {17643225600., 8821612800., 2075673600., 302702400., 30270240.,
+		2162160, 110880, 3960, 90, 1};
+static const double expm_b13[] = {64764752532480000., 32382376266240000., 7771770303897600.,
+		1187353796428800., 129060195264000., 10559470521600., 670442572800.,
+		33522128640., 1323241920., 40840800., 960960., 16380., 182., 1.};
+
+// y = b*I + sum of c[i] * x[i], for nxn arrays
+static void expm_sum(size_t n, double *y, double b, size_t len, const double *c, double **x){
+	size_t nn = n*n;
+	for(size_t i = 0; i < nn; i++){
+		double t = 0;
+		for(size_t j = 0; j < len; j++)
+			t += c[j] * x[j][i];
+		y[i] = t;
+	}
+	for(size_t i = 0; i < n; i++)
+		y[i*n + i] += b;
+}
+
+/*
+ * Produces the matrix exponential, e^m, by scaling and squaring
+ * m is scaled by 2^-s until its 1-norm is small enough for the cheapest diagonal Pade approximant of
+ * degree 3, 5, 7, 9 or 13 to be accurate to double precision (Higham, 2005). The approximant
+ * is found with at most six products and one LU solve, then squared s times
+ * cmx_matrix_t m - The square matrix
+ * Produces a new matrix, or a new 0x0 matrix if m is not square, the approximant cannot be solved or memory runs out
+ */
+cmx_matrix_t cmx_expm(cmx_matrix_t m){
+	if(m.rows != m.columns){
+		printf("ERROR: cannot find exponential of %zux%zu matrix. Matrix not square.\n", m.rows, m.columns);
+		return cmx_make(0, 0);
+	}
+	size_t n = m.rows, nn = n*n;
+	if(n == 0)
+		return cmx_make(0, 0);
+
+	double norm = 0;
+	for(size_t j = 0; j < n; j++){
+		double c = 0;
+		for(size_t i = 0; i < n; i++)
+			c += fabs(m.data[i*n + j]);
+		if(c > norm)
+			norm = c;
+	}
+	int d = 0;
+	while(d < 4 && norm > expm_theta[d])
+		d++;
+	int s = 0;
+	if(d == 4 && norm > expm_theta[4])
+		s = (int)ceil(log2(norm / expm_theta[4]));
+
+	// Scaled A, its even powers A2, A4, A6, A8, and a temporary
+	double *buffer = (double*)malloc(sizeof(double) * nn * 6);
+	cmx_matrix_t U = cmx_make(n, n), V = cmx_make(n, n);
+	if(buffer == NULL || U.rows != n || V.rows != n){
+		printf("ERROR: Out of memory finding exponential of %zux%zu matrix.\n", n, n);
+		free(buffer);
+		cmx_destroy(U);
+		cmx_destroy(V);
+		return cmx_make(0, 0);
+	}
+	double *w = cmx_strassen_enabled? strassen_alloc(strassen_workspace(n, n, n)): NULL;
+	double *A = buffer, *A2 = A + nn, *A4 = A2 + nn, *A6 = A4 + nn, *A8 = A6 + nn, *T = A8 + nn;
+	double scale = ldexp(1.0, -s);
+	for(size_t i = 0; i < nn; i++)
+		A[i] = m.data[i] * scale;
+
+	int degree = expm_degree[d];
+	square_product(n, A, A, A2, w);
+	if(degree >= 5) square_product(n, A2, A2, A4, w);
+	if(degree >= 7) square_product(n, A4, A2, A6, w);
+	if(degree == 9) square_product(n, A6, A2, A8, w);
+
+	if(degree == 13){
+		const double *b = expm_b13;
+		double *p[] = {A6, A4, A2};
+		// U = A [A6 (b13 A6 + b11 A4 + b9 A2) + b7 A6 + b5 A4 + b3 A2 + b1 I]
+		double cu[] = {b[13], b[11], b[9]}, cu2[] = {b[7], b[5], b[3]};
+		expm_sum(n, T, 0, 3, cu, p);
+		square_product(n, A6, T, V.data, w);
+		expm_sum(n, T, b[1], 3, cu2, p);
+		for(size_t i = 0; i < nn; i++)
+			T[i] += V.data[i];
+		square_product(n, A, T, U.data, w);
+		// V = A6 (b12 A6 + b10 A4 + b8 A2) + b6 A6 + b4 A4 + b2 A2 + b0 I
+		double cv[] = {b[12], b[10], b[8]}, cv2[] = {b[6], b[4], b[2]};
+		expm_sum(n, T, 0, 3, cv, p);
+		square_product(n, A6, T, V.data, w);
+		expm_sum(n, T, b[0], 3, cv2, p);
+		for(size_t i = 0; i < nn; i++)
+			V.data[i] += T[i];
+	}
+	else{
+		const double *b = (degree == 3)? expm_b3: (degree == 5)? expm_b5: (degree == 7)? expm_b7: expm_b9;
+		double *p[] = {A2, A4, A6, A8};
+		double cu[4], cv[4];
+		size_t len = (size_t)degree / 2;
+		for(size_t j = 0; j < len; j++){
+			cu[j] = b[2*j + 3];
+			cv[j] = b[2*j + 2];
+		}
+		// U = A (b1 I + b3 A2 + ...), V = b0 I + b2 A2 + ...
+		expm_sum(n, T, b[1], len, cu, p);
+		square_product(n, A, T, U.data, w);
+		expm_sum(n, V.data, b[0], len, cv, p);
+	}
+	free(buffer);
+
+	// e^A ~ (V - U)^-1 (V + U)
+	for(size_t i = 0; i < nn; i++){
+		double u = U.data[i];
+		U.data[i] = V.data[i] + u;
+		V.data[i] -= u;
+	}
+	cmx_lu_t f = cmx_lu(V);
+	cmx_matrix_t X = cmx_lu_solve(f, U);
+	cmx_lu_destroy(f);
+	cmx_destroy(V);
+	cmx_destroy(U);
+	if(X.rows != n){
+		printf("ERROR: Pade denominator is singular, cannot find exponential.\n");
+		free(w);
+		return X;
+	}
+
+	// Undo the scaling, e^m = (e^A)^(2^s), between two buffers
+	cmx_matrix_t Y = cmx_make(n, n);
+	if(s > 0 && Y.rows != n){
+		cmx_destroy(X);
+		free(w);
+		return Y;
+	}
+	for(int i = 0; i < s; i++){
+		square_product(n, X.data, X.data, Y.data, w);
+		cmx_matrix_t t = X; X = Y; Y = t;
+	}
+	cmx_destroy(Y);
+	free(w);
+	return X;
+}
+
+// Tile sizes for cmx_gemm, chosen so a tile of B stays in L2
+#define CMX_GEMM_MB 64
+#define CMX_GEMM_KB 128
+#define CMX_GEMM_NB 256
+
+/*
+ * General matrix multiply on raw row-major arrays, C = alpha*op(A)*op(B) + beta*C
+ * op(X) is X for 'n' and X transposed for 't'
+ * char ta, tb - Whether to transpose A and B
+ * size_t m, n, k - op(A) is mxk, op(B) is kxn and C is mxn
+ * double alpha - Scalar applied to the product
+ * const double *A, *B - The input arrays, with row strides lda and ldb
+ * double beta - Scalar applied to C before accumulating. 0 ignores C's contents
+ * double *C - The output array, with row stride ldc
+ * Rows of C are split between threads once the product is large enough
+ */
+void cmx_gemm(char ta, char tb, size_t m, size_t n, size_t k,
+		double alpha, const double *A, size_t lda,
+		const double *B, size_t ldb,
+		double beta, double *C, size_t ldc){
+	int at = (ta == 't' || ta == 'T');
+	int bt = (tb == 't' || tb == 'T');
+
+	#pragma omp parallel for schedule(dynamic) if(m*n*k >= CMX_PARALLEL_THRESHOLD)
+	for(size_t ib = 0; ib < m; ib += CMX_GEMM_MB){
+		size_t ie = (ib + CMX_GEMM_MB < m)? ib + CMX_GEMM_MB: m;
+
+		for(size_t i = ib; i < ie; i++){
+			double *c = C + i*ldc;
+			if(beta == 0)
+				for(size_t j = 0; j < n; j++) c[j] = 0;
+			else if(beta != 1)
+				for(size_t j = 0; j < n; j++) c[j] *= beta;
+		}
+
+		for(size_t pb = 0; pb < k; pb += CMX_GEMM_KB){
+			size_t pe = (pb + CMX_GEMM_KB < k)? pb + CMX_GEMM_KB: k;
+			for(size_t jb = 0; jb < n; jb += CMX_GEMM_NB){
+				size_t je = (jb + CMX_GEMM_NB < n)? jb + CMX_GEMM_NB: n;
+				for(size_t i = ib; i < ie; i++){
+					double *c = C + i*ldc;
+					if(!bt){
+						// Broadcast A(i,p) along row p of B
+						for(size_t p = pb; p < pe; p++){
+							double a = alpha * (at? A[p*lda + i]: A[i*lda + p]);
+							if(a == 0) continue;
+							const double *b = B + p*ldb;
+							for(size_t j = jb; j < je; j++)
+								c[j] += a * b[j];
+						}
+					} else {
+						// Rows of B are columns of op(B), so take dot products
+						for(size_t j = jb; j < je; j++){
+							const double *b = B + j*ldb;
+							double t = 0;
+							if(at)
+								for(size_t p = pb; p < pe; p++) t += A[p*lda + i] * b[p];
+							else {
+								const double *a = A + i*lda;
+								for(size_t p = pb; p < pe; p++) t += a[p] * b[p];
+							}
+							c[j] += alpha * t;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+ * A cmx_matvec_f for a dense matrix, y = m x
+ * const double *x - The input vector, m.columns long
+ * double *y - The output vector, m.rows long
+ * void *m - Pointer to the cmx_matrix_t to multiply by
+ */
+void cmx_matvec(const double *x, double *y, void *m){
+	cmx_matrix_t *a = (cmx_matrix_t*)m;
+	cmx_gemm('n', 't', a->rows, 1, a->columns, 1.0, a->data, a->columns, x, a->columns, 0.0, y, 1);
+}
+
 /*
  * Creates a new matrix which is the transpose of m
  * cmx_matrix_t m - The matrix to be transposed
@@ -363,7 +874,7 @@ cmx_matrix_t cmx_inverse(cmx_matrix_t m){
 		printf("ERROR: Determinant of matrix zero, cannot find inverse.\n");
 		return m;
 	}
-	cmx_matrix_t minor_temp, inverse, C = cmx_copy(m);
+	cmx_matrix_t minor_temp, inverse, C = cmx_make(m.rows, m.columns);
 	for(size_t i = 0; i < m.rows; i++){
 		for(size_t j = 0; j < m.columns; j++){
 				minor_temp = cmx_minor(m, i, j);
@@ -405,6 +916,7 @@ cmx_matrix_t cmx_put(cmx_matrix_t m, double d, size_t r, size_t c){
 		printf("Index out of bounds error accessing matrix at (%d,%d). Matrix has size %dx%d\n", r, c, m.rows, m.columns);
 		return m;
 	}
+	m = cmx_detach(m);
 	m.data[r*m.columns + c] = d;
 	return m;
 }
@@ -436,6 +948,7 @@ cmx_matrix_t cmx_putr(cmx_matrix_t m, cmx_matrix_t row, size_t r){
 		printf("Error putting row in matrix. m: %dx%d r: %dx%d, at %d", m.rows, m.columns, row.rows, row.columns, r);
 		return m;
 	}
+	m = cmx_detach(m);
 	for(size_t i = 0; i < m.columns; i++)
 		cmx_put(m, cmx_get(row, 0, i), r, i);
 	return m;
@@ -544,6 +1057,7 @@ size_t cmx_get_leader_col(cmx_matrix_t m, size_t r){
  * cmx_matrix_t m - The matrix to order
  */
 cmx_matrix_t cmx_order_rows(cmx_matrix_t m){
+	m = cmx_detach(m);
 	size_t hlp=0, hlr, bottom=m.rows-1, lp;
 
 	// For each row
@@ -576,6 +1090,7 @@ cmx_matrix_t cmx_order_rows(cmx_matrix_t m){
  * cmx_matrix_t m - The matrix to manipulate
  */
 cmx_matrix_t cmx_shift_zeros(cmx_matrix_t m){
+	m = cmx_detach(m);
 	size_t last = m.rows-1;
 	size_t lp;
 	for(size_t i = 0; i < last; i++){
@@ -593,6 +1108,7 @@ cmx_matrix_t cmx_shift_zeros(cmx_matrix_t m){
  * MAKE SURE TO CALL srand(time(NULL)) BEFORE USING cmx_matrix_t m - The matrix to 'noise'
  */
 cmx_matrix_t cmx_noise(cmx_matrix_t m){
+	m = cmx_detach(m);
 	for(size_t i = 0; i < m.rows*m.columns; i++){
 		m.data[i] = (double)rand()/RAND_MAX;
 	}
@@ -715,6 +1231,7 @@ void cmx_store_matrix(cmx_matrix_t m, char* fname, char mode){
 
 /*
  * Loads matrices in bulk from a file and returns them in an array of length l
+ * Packed records from cmx_packed_store_file are expanded to dense matrices
  * char* fname - The file name to read from
  * size_t l - The number of matrices to read from t he file
  */
@@ -732,6 +1249,19 @@ cmx_matrix_t* cmx_load_file(char* fname, size_t l){
 	//cmx_matrix_t ms[l];
 	for(size_t j = 0; j < l; j++){
 		fread( &rows, sizeof(size_t), 1, f );
+
+		// Records from cmx_packed_store_file come back dense
+		if(rows == CMX_PACKED_MARKER){
+			cmx_packed_t p;
+			if(cmx_packed_fread(f, &p)){
+				printf("Error reading packed matrix %zu from '%s'.\n", j, fname);
+				ms[j] = cmx_make(0, 0);
+				continue;
+			}
+			ms[j] = cmx_unpack(p);
+			cmx_packed_destroy(p);
+			continue;
+		}
 		fread( &columns, sizeof(size_t), 1, f );
 	
 		ms[j] = cmx_make(rows, columns);
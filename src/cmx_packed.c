@@ -0,0 +1,442 @@
+#include <string.h>
+#include <cmx_packed.h>
+#include <cmx_lu.h>
+
+// Where A(i,j) of a band with ku diagonals above the main one is stored
+static size_t band_index(size_t n, size_t ku, size_t i, size_t j){
+	return (ku + i - j)*n + j;
+}
+
+// Whether A(i,j) of a band is stored
+static int band_holds(size_t kl, size_t ku, size_t i, size_t j){
+	return (i >= j)? i - j <= kl: j - i <= ku;
+}
+
+// Where A(i,j) of a packed triangle is stored. j <= i for 'l' and j >= i for 'u'
+static size_t tri_index(size_t n, char uplo, size_t i, size_t j){
+	if(uplo == 'l')
+		return i*(i+1)/2 + j;
+	return i*n - i*(i-1)/2 + j - i;
+}
+
+// Whether A(i,j) lies in the stored triangle
+static int tri_holds(char uplo, size_t i, size_t j){
+	return (uplo == 'l')? j <= i: j >= i;
+}
+
+/*
+ * Makes an empty packed matrix of the given structure, with room for all its entries
+ */
+static cmx_packed_t packed_make(char structure, char uplo, size_t n, size_t kl, size_t ku){
+	cmx_packed_t p = {structure, uplo, n, kl, ku, NULL};
+	p.data = (double*)calloc(cmx_packed_length(p) + 1, sizeof(double));
+	return p;
+}
+
+/*
+ * Gets the number of doubles a packed matrix stores
+ */
+size_t cmx_packed_length(cmx_packed_t p){
+	if(p.structure == 'b')
+		return (p.kl + p.ku + 1) * p.n;
+	return p.n * (p.n + 1) / 2;
+}
+
+/*
+ * Packs one triangle of a square matrix
+ * cmx_matrix_t m - The matrix. Left unchanged
+ * char structure - 's' if the matrix is symmetric, 't' if it is triangular
+ * char uplo - The triangle to keep, 'l'ower or 'u'pper. The other is never read
+ * Free the result with cmx_packed_destroy
+ */
+cmx_packed_t cmx_pack(cmx_matrix_t m, char structure, char uplo){
+	if(m.rows != m.columns || (structure != 's' && structure != 't') || (uplo != 'l' && uplo != 'u')){
+		printf("ERROR: cannot pack %zux%zu matrix as \'%c\' \'%c\'. Matrix must be square, structure \'s\' or \'t\' and triangle \'l\' or \'u\'.\n", m.rows, m.columns, structure, uplo);
+		return packed_make('t', 'l', 0, 0, 0);
+	}
+	size_t n = m.rows;
+	cmx_packed_t p = packed_make(structure, uplo, n, 0, 0);
+	for(size_t i = 0; i < n; i++){
+		size_t j0 = (uplo == 'l')? 0: i, j1 = (uplo == 'l')? i+1: n;
+		memcpy(p.data + tri_index(n, uplo, i, j0), m.data + i*n + j0, sizeof(double) * (j1 - j0));
+	}
+	return p;
+}
+
+/*
+ * Packs a banded square matrix into LAPACK band storage
+ * cmx_matrix_t m - The matrix. Left unchanged, and entries outside the band are never read
+ * size_t kl, ku - The number of diagonals below and above the main one to keep
+ * Free the result with cmx_packed_destroy
+ */
+cmx_packed_t cmx_pack_band(cmx_matrix_t m, size_t kl, size_t ku){
+	if(m.rows != m.columns){
+		printf("ERROR: cannot pack %zux%zu matrix as a band. Matrix not square.\n", m.rows, m.columns);
+		return packed_make('b', 'l', 0, 0, 0);
+	}
+	size_t n = m.rows;
+	if(kl >= n) kl = (n > 0)? n-1: 0;
+	if(ku >= n) ku = (n > 0)? n-1: 0;
+	cmx_packed_t p = packed_make('b', 'l', n, kl, ku);
+	for(size_t i = 0; i < n; i++){
+		size_t j0 = (i > kl)? i - kl: 0, j1 = (i + ku < n)? i + ku + 1: n;
+		for(size_t j = j0; j < j1; j++)
+			p.data[band_index(n, ku, i, j)] = m.data[i*n + j];
+	}
+	return p;
+}
+
+/*
+ * Gets an element of a packed matrix
+ * size_t r, c - Row and column of the element
+ */
+double cmx_packed_get(cmx_packed_t p, size_t r, size_t c){
+	if(r >= p.n || c >= p.n){
+		printf("ERROR: Element (%zu, %zu) is outside the %zux%zu packed matrix.\n", r, c, p.n, p.n);
+		return 0;
+	}
+	if(p.structure == 'b')
+		return band_holds(p.kl, p.ku, r, c)? p.data[band_index(p.n, p.ku, r, c)]: 0;
+	if(tri_holds(p.uplo, r, c))
+		return p.data[tri_index(p.n, p.uplo, r, c)];
+	return (p.structure == 's')? p.data[tri_index(p.n, p.uplo, c, r)]: 0;
+}
+
+/*
+ * Expands a packed matrix back to a dense one
+ */
+cmx_matrix_t cmx_unpack(cmx_packed_t p){
+	size_t n = p.n;
+	cmx_matrix_t m = cmx_make(n, n);
+	for(size_t i = 0; i < n; i++)
+		for(size_t j = 0; j < n; j++)
+			m.data[i*n + j] = cmx_packed_get(p, i, j);
+	return m;
+}
+
+/*
+ * Frees a packed matrix
+ */
+void cmx_packed_destroy(cmx_packed_t p){
+	free(p.data);
+}
+
+// The columns [*j0, *j1) of row i that may be nonzero
+static void packed_row(cmx_packed_t p, size_t i, size_t *j0, size_t *j1){
+	if(p.structure == 'b'){
+		*j0 = (i > p.kl)? i - p.kl: 0;
+		*j1 = (i + p.ku < p.n)? i + p.ku + 1: p.n;
+	}
+	else if(p.structure == 's'){
+		*j0 = 0;
+		*j1 = p.n;
+	}
+	else{
+		*j0 = (p.uplo == 'l')? 0: i;
+		*j1 = (p.uplo == 'l')? i+1: p.n;
+	}
+}
+
+/*
+ * Multiplies a packed matrix by a dense one, C = A B, touching only the entries that may be nonzero
+ * Symmetric matrices read each stored entry for both of its positions. Rows of C are split between threads
+ * cmx_packed_t p - The packed matrix A
+ * cmx_matrix_t B - The dense matrix, with n rows
+ * Produces a new nxk matrix
+ */
+cmx_matrix_t cmx_packed_product(cmx_packed_t p, cmx_matrix_t B){
+	size_t n = p.n, k = B.columns;
+	cmx_matrix_t C = cmx_make(n, k);
+	if(B.rows != n){
+		printf("Size mismatch when multiplying matrices together. Given packed %zux%zu and %zux%zu\n", n, n, B.rows, B.columns);
+		return C;
+	}
+	size_t width = (p.structure == 'b')? p.kl + p.ku + 1: n;
+
+	#pragma omp parallel for schedule(dynamic, 16) if(n*width*k >= CMX_PARALLEL_THRESHOLD)
+	for(size_t i = 0; i < n; i++){
+		size_t j0, j1;
+		packed_row(p, i, &j0, &j1);
+		double *c = C.data + i*k;
+		for(size_t j = j0; j < j1; j++){
+			double a;
+			if(p.structure == 'b')
+				a = p.data[band_index(n, p.ku, i, j)];
+			else if(tri_holds(p.uplo, i, j))
+				a = p.data[tri_index(n, p.uplo, i, j)];
+			else
+				a = p.data[tri_index(n, p.uplo, j, i)];
+			if(a == 0) continue;
+			const double *b = B.data + j*k;
+			for(size_t q = 0; q < k; q++)
+				c[q] += a * b[q];
+		}
+	}
+	return C;
+}
+
+/*
+ * Solves A X = B for a packed triangular A, by forward or backward substitution in O(n^2 k)
+ */
+static cmx_matrix_t tri_solve(cmx_packed_t p, cmx_matrix_t B){
+	size_t n = p.n, k = B.columns;
+	cmx_matrix_t X = cmx_detach(cmx_copy(B));
+	double *x = X.data;
+	for(size_t s = 0; s < n; s++){
+		size_t i = (p.uplo == 'l')? s: n-1 - s;
+		size_t j0, j1;
+		packed_row(p, i, &j0, &j1);
+		double *xi = x + i*k;
+		const double *row = p.data + tri_index(n, p.uplo, i, j0);
+		for(size_t j = j0; j < j1; j++){
+			if(j == i) continue;
+			double a = row[j - j0];
+			const double *xj = x + j*k;
+			for(size_t q = 0; q < k; q++)
+				xi[q] -= a * xj[q];
+		}
+		double d = row[i - j0];
+		if(d == 0){
+			printf("ERROR: Zero on the diagonal at %zu, triangular matrix is singular.\n", i);
+			cmx_destroy(X);
+			return cmx_make(0, 0);
+		}
+		for(size_t q = 0; q < k; q++)
+			xi[q] /= d;
+	}
+	return X;
+}
+
+/*
+ * Solves A X = B for X, using the structure of the packed matrix A
+ * Triangular matrices use substitution in O(n^2 k), bands use cmx_band_lu in O(n kl (kl+ku)).
+ * Symmetric matrices are unpacked and solved with cmx_lu, or use cmx_chol on cmx_unpack when positive definite
+ * cmx_packed_t p - The packed matrix A
+ * cmx_matrix_t B - The right hand sides, one per column
+ * Produces a new matrix the same size as B, or a new 0x0 matrix if the sizes differ or A is singular
+ */
+cmx_matrix_t cmx_packed_solve(cmx_packed_t p, cmx_matrix_t B){
+	if(B.rows != p.n){
+		printf("ERROR: Size mismatch solving with packed %zux%zu and right hand side %zux%zu\n", p.n, p.n, B.rows, B.columns);
+		return cmx_make(0, 0);
+	}
+	if(p.structure == 't')
+		return tri_solve(p, B);
+	if(p.structure == 'b'){
+		cmx_band_lu_t f = cmx_band_lu(p);
+		cmx_matrix_t X = cmx_band_lu_solve(f, B);
+		cmx_band_lu_destroy(f);
+		return X;
+	}
+	cmx_matrix_t A = cmx_unpack(p);
+	cmx_lu_t f = cmx_lu(A);
+	cmx_matrix_t X = cmx_lu_solve(f, B);
+	cmx_lu_destroy(f);
+	cmx_destroy(A);
+	return X;
+}
+
+/*
+ * Produces the LU factors of a banded matrix with partial pivoting, in O(n kl (kl+ku))
+ * Pivots are searched for only within the band, so the factors stay banded
+ * cmx_packed_t p - The banded matrix, from cmx_pack_band
+ * Free the result with cmx_band_lu_destroy
+ */
+cmx_band_lu_t cmx_band_lu(cmx_packed_t p){
+	cmx_band_lu_t f = {packed_make('b', 'l', 0, 0, 0), NULL, 1};
+	if(p.structure != 'b'){
+		printf("ERROR: cannot find band LU factors of packed \'%c\' matrix. Pack it with cmx_pack_band.\n", p.structure);
+		return f;
+	}
+	size_t n = p.n, kl = p.kl, ku = p.ku, kf = kl + ku;
+	cmx_packed_destroy(f.lu);
+	f.lu = packed_make('b', 'l', n, kl, kf);
+	f.pivot = (size_t*)malloc(sizeof(size_t) * (n + 1));
+	f.singular = 0;
+	double *a = f.lu.data;
+	for(size_t i = 0; i < n; i++){
+		size_t j0 = (i > kl)? i - kl: 0, j1 = (i + ku < n)? i + ku + 1: n;
+		for(size_t j = j0; j < j1; j++)
+			a[band_index(n, kf, i, j)] = p.data[band_index(n, ku, i, j)];
+	}
+
+	for(size_t j = 0; j < n; j++){
+		size_t last = (j + kl < n)? j + kl: n-1;
+		size_t end = (j + kf < n)? j + kf: n-1;
+		size_t piv = j;
+		double best = fabs(a[band_index(n, kf, j, j)]);
+		for(size_t i = j+1; i <= last; i++)
+			if(fabs(a[band_index(n, kf, i, j)]) > best){
+				best = fabs(a[band_index(n, kf, i, j)]);
+				piv = i;
+			}
+		f.pivot[j] = piv;
+		if(best == 0){
+			f.singular = 1;
+			continue;
+		}
+		if(piv != j)
+			for(size_t c = j; c <= end; c++){
+				size_t x = band_index(n, kf, j, c), y = band_index(n, kf, piv, c);
+				double t = a[x];
+				a[x] = a[y];
+				a[y] = t;
+			}
+
+		double d = a[band_index(n, kf, j, j)];
+		for(size_t i = j+1; i <= last; i++){
+			double l = a[band_index(n, kf, i, j)] / d;
+			a[band_index(n, kf, i, j)] = l;
+			if(l != 0)
+				for(size_t c = j+1; c <= end; c++)
+					a[band_index(n, kf, i, c)] -= l * a[band_index(n, kf, j, c)];
+		}
+	}
+	return f;
+}
+
+/*
+ * Solves A X = B for X, given the band LU factors of A, in O(n (2kl + ku) k)
+ * cmx_band_lu_t f - The factors of A, from cmx_band_lu
+ * cmx_matrix_t B - The right hand sides, one per column
+ * Produces a new matrix the same size as B, or a new 0x0 matrix if the sizes differ or A is singular
+ */
+cmx_matrix_t cmx_band_lu_solve(cmx_band_lu_t f, cmx_matrix_t B){
+	size_t n = f.lu.n, kl = f.lu.kl, kf = f.lu.ku, k = B.columns;
+	if(B.rows != n){
+		printf("ERROR: Size mismatch solving with band LU factors %zux%zu and right hand side %zux%zu\n", n, n, B.rows, B.columns);
+		return cmx_make(0, 0);
+	}
+	if(f.singular){
+		printf("ERROR: Matrix is singular, cannot solve with its band LU factors.\n");
+		return cmx_make(0, 0);
+	}
+	cmx_matrix_t X = cmx_detach(cmx_copy(B));
+	double *x = X.data, *a = f.lu.data;
+
+	// Forward, applying each swap and elimination step in the order they were made
+	for(size_t j = 0; j < n; j++){
+		double *xj = x + j*k;
+		if(f.pivot[j] != j){
+			double *xp = x + f.pivot[j]*k;
+			for(size_t q = 0; q < k; q++){
+				double t = xj[q];
+				xj[q] = xp[q];
+				xp[q] = t;
+			}
+		}
+		size_t last = (j + kl < n)? j + kl: n-1;
+		for(size_t i = j+1; i <= last; i++){
+			double l = a[band_index(n, kf, i, j)];
+			double *xi = x + i*k;
+			for(size_t q = 0; q < k; q++)
+				xi[q] -= l * xj[q];
+		}
+	}
+
+	// Backward through U, which reaches kl+ku diagonals above the main one
+	for(size_t i = n; i-- > 0; ){
+		double *xi = x + i*k;
+		size_t end = (i + kf < n)? i + kf: n-1;
+		for(size_t c = i+1; c <= end; c++){
+			double u = a[band_index(n, kf, i, c)];
+			const double *xc = x + c*k;
+			for(size_t q = 0; q < k; q++)
+				xi[q] -= u * xc[q];
+		}
+		double d = a[band_index(n, kf, i, i)];
+		for(size_t q = 0; q < k; q++)
+			xi[q] /= d;
+	}
+	return X;
+}
+
+/*
+ * Frees the factors from cmx_band_lu
+ */
+void cmx_band_lu_destroy(cmx_band_lu_t f){
+	cmx_packed_destroy(f.lu);
+	free(f.pivot);
+}
+
+/*
+ * Stores packed matrices to a file, keeping only the entries they hold
+ * Each record starts with CMX_PACKED_MARKER where cmx_store_file puts the row count,
+ * then the structure, triangle, n, kl and ku as size_t, then the stored entries.
+ * Records can be mixed with cmx_store_file ones in the same file, and cmx_load_file
+ * reads them back as dense matrices
+ * cmx_packed_t *p - An array of packed matrices
+ * size_t length - The number of matrices in the array
+ * char* fname - The file name to write to
+ * char mode - 'w' to write over the file, 'a' to append to it
+ */
+void cmx_packed_store_file(cmx_packed_t *p, size_t length, char* fname, char mode){
+	FILE *f = NULL;
+	if(mode == 'w')
+		f = fopen(fname, "wb");
+	else if(mode == 'a')
+		f = fopen(fname, "ab");
+	else
+		printf("Error opening \'%s\'. Write mode \'%c\'not recognised", fname, mode);
+
+	if(f == NULL){
+		printf("Error opening \'%s\' to write to. Aborting.\n", fname);
+		return;
+	}
+
+	for(size_t i = 0; i < length; i++){
+		size_t header[6] = {CMX_PACKED_MARKER, (size_t)p[i].structure, (size_t)p[i].uplo, p[i].n, p[i].kl, p[i].ku};
+		fwrite(header, sizeof(size_t), 6, f);
+		fwrite(p[i].data, sizeof(double), cmx_packed_length(p[i]), f);
+	}
+	fclose(f);
+}
+
+/*
+ * Reads one packed record from an open file, from just after its CMX_PACKED_MARKER
+ * cmx_packed_t *p - Set to the packed matrix read
+ * Returns non-zero if the record is cut short or not understood
+ */
+int cmx_packed_fread(FILE *f, cmx_packed_t *p){
+	size_t header[5];
+	if(fread(header, sizeof(size_t), 5, f) != 5)
+		return 1;
+	char structure = (char)header[0], uplo = (char)header[1];
+	if((structure != 's' && structure != 't' && structure != 'b') || (uplo != 'l' && uplo != 'u'))
+		return 1;
+	*p = packed_make(structure, uplo, header[2], header[3], header[4]);
+	size_t len = cmx_packed_length(*p);
+	if(fread(p->data, sizeof(double), len, f) != len){
+		cmx_packed_destroy(*p);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Loads packed matrices in bulk from a file and returns them in an array of length l
+ * Every record must have been stored with cmx_packed_store_file
+ * char* fname - The file name to read from
+ * size_t l - The number of matrices to read from the file
+ */
+cmx_packed_t* cmx_packed_load_file(char* fname, size_t l){
+	FILE *f = fopen(fname, "rb");
+	if(f == NULL){
+		printf("Error opening file to read from. Aborting.\n");
+		return NULL;
+	}
+	cmx_packed_t *ps = (cmx_packed_t*)malloc(sizeof(cmx_packed_t) * l);
+	for(size_t j = 0; j < l; j++){
+		size_t marker = 0;
+		if(fread(&marker, sizeof(size_t), 1, f) != 1 || marker != CMX_PACKED_MARKER || cmx_packed_fread(f, ps + j)){
+			printf("Error reading packed matrix %zu from \'%s\'. Aborting.\n", j, fname);
+			for(size_t i = 0; i < j; i++)
+				cmx_packed_destroy(ps[i]);
+			free(ps);
+			fclose(f);
+			return NULL;
+		}
+	}
+	fclose(f);
+	return ps;
+}
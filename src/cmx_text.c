@@ -0,0 +1,725 @@
+#include <stdint.h>
+#include <float.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cmx_text.h>
+
+// Most significant digits the fast parser holds in one integer
+#define TEXT_MAX_DIGITS 19
+// Longest number handed to strtod when the fast parser cannot be exact
+#define TEXT_MAX_TOKEN 64
+// Longest value text_format writes, "-2.2250738585072014e-308"
+#define TEXT_MAX_VALUE 24
+
+// Every power of ten that is exact as a double
+static const double text_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ *	Values parsed from one chunk of a file, in file order.
+ *	rows and columns count CSV lines and the fields on each. error is non-zero if parsing failed
+ */
+typedef struct text_piece {
+	double *values;
+	size_t length, capacity;
+	size_t rows, columns;
+	int error;
+} text_piece_t;
+
+// Formats line i of m into buf, returning the number of characters written
+typedef size_t (*text_line_f)(char *buf, cmx_matrix_t m, size_t i, char delim);
+
+/*
+ * Maps a whole file read-only
+ * const char **text - Set to the contents, or NULL if the file is empty
+ * size_t *len - Set to the length of the file
+ * Returns non-zero if the file could not be read
+ */
+static int text_map(char *fname, const char **text, size_t *len){
+	int fd = open(fname, O_RDONLY);
+	if(fd < 0){
+		printf("Error opening \'%s\' to read from. Aborting.\n", fname);
+		return 1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0){
+		printf("Error reading size of \'%s\'. Aborting.\n", fname);
+		close(fd);
+		return 1;
+	}
+	*len = (size_t)st.st_size;
+	*text = NULL;
+	if(*len > 0){
+		void *p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p == MAP_FAILED){
+			printf("Error mapping \'%s\' into memory. Aborting.\n", fname);
+			close(fd);
+			return 1;
+		}
+		madvise(p, *len, MADV_SEQUENTIAL);
+		*text = (const char*)p;
+	}
+	close(fd);
+	return 0;
+}
+
+static void text_unmap(const char *text, size_t len){
+	if(text != NULL)
+		munmap((void*)text, len);
+}
+
+/*
+ * Splits text into chunks of about CMX_TEXT_CHUNK bytes, each ending just after a newline
+ * size_t **starts - Set to where each chunk starts, with one extra entry holding len. Free after use
+ * Returns the number of chunks
+ */
+static size_t text_split(const char *text, size_t len, size_t **starts){
+	size_t *s = (size_t*)malloc(sizeof(size_t) * (len / CMX_TEXT_CHUNK + 2));
+	size_t n = 0, at = 0;
+	s[0] = 0;
+	while(at < len){
+		size_t next = at + CMX_TEXT_CHUNK;
+		if(next >= len)
+			next = len;
+		else{
+			const char *nl = (const char*)memchr(text + next, '\n', len - next);
+			next = (nl == NULL)? len: (size_t)(nl - text) + 1;
+		}
+		s[++n] = next;
+		at = next;
+	}
+	*starts = s;
+	return n;
+}
+
+// Skips spaces and tabs, except tabs when they are the delimiter
+static const char* text_blank(const char *p, const char *end, char delim){
+	while(p < end && (*p == ' ' || (*p == '\t' && delim != '\t')))
+		p++;
+	return p;
+}
+
+static int text_digit(const char *p, const char *end){
+	return p < end && (unsigned)(*p - '0') < 10;
+}
+
+/*
+ * Parses a number at p with strtod. Used for anything the fast path cannot do exactly
+ * Returns the first character after the number, or NULL if there is none
+ */
+static const char* text_slow(const char *p, const char *end, double *out){
+	char token[TEXT_MAX_TOKEN];
+	size_t n = 0;
+	while(p + n < end && n < TEXT_MAX_TOKEN - 1){
+		char c = p[n];
+		if(!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '.' || c == '+' || c == '-'))
+			break;
+		token[n++] = c;
+	}
+	token[n] = '\0';
+	char *stop;
+	*out = strtod(token, &stop);
+	if(stop == token)
+		return NULL;
+	return p + (stop - token);
+}
+
+/*
+ * Parses a double at p without reading at or past end
+ * Up to 19 significant digits with a decimal exponent within 22 are read as one integer
+ * scaled by one exact power of ten, so the result is correctly rounded without strtod.
+ * Anything else, including inf and nan, goes through strtod
+ * double *out - Set to the value
+ * Returns the first character after the number, or NULL if there is no number at p
+ */
+static const char* text_double(const char *p, const char *end, double *out){
+	const char *start = p;
+	int neg = 0, digits = 0, seen = 0;
+	long exp = 0;
+	uint64_t m = 0;
+
+	if(p < end && (*p == '-' || *p == '+')){
+		neg = (*p == '-');
+		p++;
+	}
+	while(p < end && *p == '0'){
+		p++;
+		seen = 1;
+	}
+	for(; text_digit(p, end); p++, digits++){
+		if(digits < TEXT_MAX_DIGITS)
+			m = m*10 + (uint64_t)(*p - '0');
+		seen = 1;
+	}
+	if(p < end && *p == '.'){
+		p++;
+		if(digits == 0)
+			for(; p < end && *p == '0'; p++, exp--)
+				seen = 1;
+		for(; text_digit(p, end); p++, digits++){
+			if(digits < TEXT_MAX_DIGITS){
+				m = m*10 + (uint64_t)(*p - '0');
+				exp--;
+			}
+			seen = 1;
+		}
+	}
+	if(!seen)
+		return text_slow(start, end, out);
+
+	if(p < end && (*p == 'e' || *p == 'E')){
+		const char *q = p + 1;
+		int eneg = 0;
+		long e = 0;
+		if(q < end && (*q == '-' || *q == '+')){
+			eneg = (*q == '-');
+			q++;
+		}
+		if(text_digit(q, end)){
+			for(; text_digit(q, end); q++)
+				if(e < 100000)
+					e = e*10 + (*q - '0');
+			exp += eneg? -e: e;
+			p = q;
+		}
+	}
+
+	if(digits > TEXT_MAX_DIGITS || exp < -22 || exp > 22)
+		return text_slow(start, end, out);
+	double v;
+	if(m <= ((uint64_t)1 << 53)){
+		v = (double)m;
+		v = (exp < 0)? v / text_pow10[-exp]: v * text_pow10[exp];
+	}
+	else{
+#if LDBL_MANT_DIG >= 64
+		// Longer mantissas, like those %.17g writes, are exact in long double. Rounding that result
+		// to double is only wrong when it lands exactly halfway between two doubles, so those go to strtod
+		long double x = (long double)m;
+		x = (exp < 0)? x / text_pow10[-exp]: x * text_pow10[exp];
+		int e2;
+		long double f = ldexpl(frexpl(x, &e2), DBL_MANT_DIG);
+		if(f - floorl(f) == 0.5L)
+			return text_slow(start, end, out);
+		v = (double)x;
+#else
+		return text_slow(start, end, out);
+#endif
+	}
+	*out = neg? -v: v;
+	return p;
+}
+
+/*
+ * Parses an unsigned integer at p
+ * Returns the first character after it, or NULL if there is none
+ */
+static const char* text_size(const char *p, const char *end, size_t *out){
+	if(!text_digit(p, end))
+		return NULL;
+	size_t v = 0;
+	for(; text_digit(p, end); p++)
+		v = v*10 + (size_t)(*p - '0');
+	*out = v;
+	return p;
+}
+
+// Appends a value to a piece, growing it as needed
+static void text_push(text_piece_t *piece, double v){
+	if(piece->length == piece->capacity){
+		piece->capacity = (piece->capacity == 0)? 1024: 2*piece->capacity;
+		piece->values = (double*)realloc(piece->values, sizeof(double) * piece->capacity);
+	}
+	piece->values[piece->length++] = v;
+}
+
+/*
+ * Copies the values of every piece, in order, into one array
+ * Returns the total number of values copied
+ */
+static size_t text_gather(text_piece_t *pieces, size_t n, double *dst){
+	size_t *offset = (size_t*)malloc(sizeof(size_t) * (n + 1));
+	offset[0] = 0;
+	for(size_t i = 0; i < n; i++)
+		offset[i+1] = offset[i] + pieces[i].length;
+	size_t total = offset[n];
+
+	#pragma omp parallel for schedule(dynamic) if(total >= CMX_PARALLEL_THRESHOLD)
+	for(size_t i = 0; i < n; i++)
+		if(pieces[i].length > 0)
+			memcpy(dst + offset[i], pieces[i].values, sizeof(double) * pieces[i].length);
+	free(offset);
+	return total;
+}
+
+static void text_free(text_piece_t *pieces, size_t n){
+	for(size_t i = 0; i < n; i++)
+		free(pieces[i].values);
+	free(pieces);
+}
+
+/*
+ * Parses whole CSV lines in [p, end) into piece, skipping blank lines
+ * Sets piece->error to 1 on a field that is not a number, 2 on a line of the wrong length
+ */
+static void csv_piece(const char *p, const char *end, char delim, text_piece_t *piece){
+	while(p < end){
+		p = text_blank(p, end, delim);
+		if(p < end && (*p == '\n' || *p == '\r')){
+			p++;
+			continue;
+		}
+		if(p >= end)
+			break;
+
+		size_t count = 0;
+		for(;;){
+			double v = NAN;
+			if(p < end && *p != delim && *p != '\n' && *p != '\r'){
+				p = text_double(p, end, &v);
+				if(p == NULL){
+					piece->error = 1;
+					return;
+				}
+			}
+			text_push(piece, v);
+			count++;
+
+			const char *q = text_blank(p, end, delim);
+			if(q >= end || *q == '\n' || *q == '\r'){
+				p = q;
+				break;
+			}
+			if(delim == ' ' && q == p){
+				piece->error = 1;
+				return;
+			}
+			if(delim != ' '){
+				if(*q != delim){
+					piece->error = 1;
+					return;
+				}
+				q = text_blank(q + 1, end, delim);
+			}
+			p = q;
+		}
+
+		if(piece->rows == 0)
+			piece->columns = count;
+		else if(count != piece->columns){
+			piece->error = 2;
+			return;
+		}
+		piece->rows++;
+	}
+}
+
+/*
+ * Reads a matrix from a CSV file, one row per line
+ * The shape is taken from the file. A first line that is not numeric is skipped as a header
+ * char* fname - The file name to read from
+ * char delim - The field separator, such as ',' or '\t'. ' ' splits on any run of spaces or tabs
+ */
+cmx_matrix_t cmx_load_csv(char* fname, char delim){
+	const char *text;
+	size_t len;
+	if(text_map(fname, &text, &len))
+		return cmx_make(0, 0);
+
+	// Skip a header, found by trying to parse the first line that has anything on it
+	size_t body = 0;
+	while(body < len && (text[body] == '\n' || text[body] == '\r' || text[body] == ' ' || text[body] == '\t'))
+		body++;
+	if(body < len){
+		const char *nl = (const char*)memchr(text + body, '\n', len - body);
+		size_t eol = (nl == NULL)? len: (size_t)(nl - text) + 1;
+		text_piece_t first = {NULL, 0, 0, 0, 0, 0};
+		csv_piece(text + body, text + eol, delim, &first);
+		if(first.error)
+			body = eol;
+		free(first.values);
+	}
+
+	size_t *starts;
+	size_t n = text_split(text + body, len - body, &starts);
+	text_piece_t *pieces = (text_piece_t*)calloc(n + 1, sizeof(text_piece_t));
+
+	#pragma omp parallel for schedule(dynamic)
+	for(size_t i = 0; i < n; i++)
+		csv_piece(text + body + starts[i], text + body + starts[i+1], delim, pieces + i);
+
+	size_t rows = 0, columns = 0;
+	int error = 0;
+	for(size_t i = 0; i < n; i++){
+		if(pieces[i].error)
+			error = pieces[i].error;
+		else if(pieces[i].rows > 0){
+			if(rows > 0 && pieces[i].columns != columns)
+				error = 2;
+			columns = pieces[i].columns;
+			rows += pieces[i].rows;
+		}
+	}
+
+	cmx_matrix_t m;
+	if(error == 1){
+		printf("ERROR: \'%s\' has a field that is not a number. Make sure the delimiter is \'%c\'.\n", fname, delim);
+		m = cmx_make(0, 0);
+	}
+	else if(error == 2){
+		printf("ERROR: Rows of \'%s\' have differing numbers of fields.\n", fname);
+		m = cmx_make(0, 0);
+	}
+	else{
+		m = cmx_make(rows, columns);
+		text_gather(pieces, n, m.data);
+	}
+
+	text_free(pieces, n);
+	free(starts);
+	text_unmap(text, len);
+	return m;
+}
+
+/*
+ * Reads the next word of a Matrix Market header in lower case
+ */
+static const char* mtx_word(const char *p, const char *end, char *word, size_t size){
+	p = text_blank(p, end, ' ');
+	size_t n = 0;
+	for(; p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r'; p++)
+		if(n < size - 1)
+			word[n++] = (*p >= 'A' && *p <= 'Z')? *p - 'A' + 'a': *p;
+	word[n] = '\0';
+	return p;
+}
+
+// Steps past the rest of the current line
+static const char* text_line_end(const char *p, const char *end){
+	const char *nl = (const char*)memchr(p, '\n', end - p);
+	return (nl == NULL)? end: nl + 1;
+}
+
+/*
+ * Parses coordinate entries in [p, end), summing them into m
+ * char field - 'r' for real or integer values, 'p' for pattern entries
+ * char symmetry - 'g' general, 's' symmetric, 'k' skew-symmetric
+ * Returns how many entries were read, or SIZE_MAX on a bad line
+ */
+static size_t mtx_coordinates(const char *p, const char *end, cmx_matrix_t m, char field, char symmetry){
+	size_t count = 0;
+	while(p < end){
+		p = text_blank(p, end, ' ');
+		if(p >= end)
+			break;
+		if(*p == '\n' || *p == '\r' || *p == '%'){
+			p = text_line_end(p, end);
+			continue;
+		}
+
+		size_t i, j;
+		double v = 1.0;
+		p = text_size(p, end, &i);
+		if(p != NULL)
+			p = text_size(text_blank(p, end, ' '), end, &j);
+		if(p != NULL && field != 'p')
+			p = text_double(text_blank(p, end, ' '), end, &v);
+		if(p == NULL || i < 1 || j < 1 || i > m.rows || j > m.columns)
+			return SIZE_MAX;
+		i--;
+		j--;
+
+		#pragma omp atomic
+		m.data[i*m.columns + j] += v;
+		if(symmetry != 'g' && i != j){
+			double w = (symmetry == 'k')? -v: v;
+			#pragma omp atomic
+			m.data[j*m.columns + i] += w;
+		}
+		count++;
+		p = text_line_end(p, end);
+	}
+	return count;
+}
+
+/*
+ * Parses array values in [p, end), one or more per line, into piece
+ */
+static void mtx_values(const char *p, const char *end, text_piece_t *piece){
+	while(p < end){
+		p = text_blank(p, end, ' ');
+		if(p >= end)
+			break;
+		if(*p == '\n' || *p == '\r'){
+			p++;
+			continue;
+		}
+		if(*p == '%'){
+			p = text_line_end(p, end);
+			continue;
+		}
+		double v;
+		p = text_double(p, end, &v);
+		if(p == NULL){
+			piece->error = 1;
+			return;
+		}
+		text_push(piece, v);
+	}
+}
+
+/*
+ * Reads a matrix from a Matrix Market file
+ * Coordinate files are read into a dense matrix, summing any repeated entries
+ * Symmetric and skew-symmetric files are filled out in full
+ * char* fname - The file name to read from
+ */
+cmx_matrix_t cmx_load_mtx(char* fname){
+	const char *text;
+	size_t len;
+	if(text_map(fname, &text, &len))
+		return cmx_make(0, 0);
+	const char *p = text, *end = text + len;
+
+	char banner[32], object[32], format[32], field[32], symmetry[32];
+	p = mtx_word(p, end, banner, sizeof(banner));
+	p = mtx_word(p, end, object, sizeof(object));
+	p = mtx_word(p, end, format, sizeof(format));
+	p = mtx_word(p, end, field, sizeof(field));
+	p = mtx_word(p, end, symmetry, sizeof(symmetry));
+
+	char fmt = 0, fld = 0, sym = 0;
+	if(strcmp(banner, "%%matrixmarket") == 0 && strcmp(object, "matrix") == 0){
+		if(strcmp(format, "coordinate") == 0) fmt = 'c';
+		else if(strcmp(format, "array") == 0) fmt = 'a';
+		if(strcmp(field, "real") == 0 || strcmp(field, "integer") == 0 || strcmp(field, "double") == 0) fld = 'r';
+		else if(strcmp(field, "pattern") == 0 && fmt == 'c') fld = 'p';
+		if(strcmp(symmetry, "general") == 0) sym = 'g';
+		else if(strcmp(symmetry, "symmetric") == 0 || strcmp(symmetry, "hermitian") == 0) sym = 's';
+		else if(strcmp(symmetry, "skew-symmetric") == 0) sym = 'k';
+	}
+	if(!fmt || !fld || !sym){
+		printf("ERROR: \'%s\' is not a real Matrix Market matrix. Header reads \'%s %s %s %s %s\'.\n", fname, banner, object, format, field, symmetry);
+		text_unmap(text, len);
+		return cmx_make(0, 0);
+	}
+
+	// Comments, then the size line
+	p = text_line_end(p, end);
+	while(p < end){
+		const char *q = text_blank(p, end, ' ');
+		if(q < end && *q != '%' && *q != '\n' && *q != '\r')
+			break;
+		p = text_line_end(p, end);
+	}
+	size_t rows = 0, columns = 0, entries = 0;
+	const char *q = text_size(text_blank(p, end, ' '), end, &rows);
+	if(q != NULL)
+		q = text_size(text_blank(q, end, ' '), end, &columns);
+	if(q != NULL && fmt == 'c')
+		q = text_size(text_blank(q, end, ' '), end, &entries);
+	if(q == NULL || (sym != 'g' && rows != columns)){
+		printf("ERROR: \'%s\' has a bad size line.\n", fname);
+		text_unmap(text, len);
+		return cmx_make(0, 0);
+	}
+	p = text_line_end(q, end);
+
+	size_t *starts;
+	size_t n = text_split(p, end - p, &starts);
+	cmx_matrix_t m = cmx_make(rows, columns);
+	int error = 0;
+
+	if(fmt == 'c'){
+		size_t count = 0;
+		#pragma omp parallel for schedule(dynamic) reduction(+:count) reduction(|:error)
+		for(size_t i = 0; i < n; i++){
+			size_t c = mtx_coordinates(p + starts[i], p + starts[i+1], m, fld, sym);
+			if(c == SIZE_MAX)
+				error = 1;
+			else
+				count += c;
+		}
+		if(error)
+			printf("ERROR: \'%s\' has an entry that is badly formed or out of range.\n", fname);
+		else if(count != entries){
+			printf("ERROR: \'%s\' should have %zu entries but has %zu.\n", fname, entries, count);
+			error = 1;
+		}
+	}
+	else{
+		text_piece_t *pieces = (text_piece_t*)calloc(n + 1, sizeof(text_piece_t));
+		#pragma omp parallel for schedule(dynamic)
+		for(size_t i = 0; i < n; i++)
+			mtx_values(p + starts[i], p + starts[i+1], pieces + i);
+
+		size_t count = 0, expect;
+		for(size_t i = 0; i < n; i++){
+			error |= pieces[i].error;
+			count += pieces[i].length;
+		}
+		if(sym == 'g') expect = rows*columns;
+		else if(sym == 's') expect = rows*(rows + 1)/2;
+		else expect = rows*(rows - (rows > 0))/2;
+
+		if(error)
+			printf("ERROR: \'%s\' has a value that is not a number.\n", fname);
+		else if(count != expect){
+			printf("ERROR: \'%s\' should have %zu values but has %zu.\n", fname, expect, count);
+			error = 1;
+		}
+		else{
+			// Values run down each column, starting at the diagonal unless the file is general
+			double *v = (double*)malloc(sizeof(double) * (count + 1));
+			text_gather(pieces, n, v);
+			size_t k = 0;
+			for(size_t j = 0; j < columns; j++){
+				size_t i0 = (sym == 'g')? 0: (sym == 's')? j: j + 1;
+				for(size_t i = i0; i < rows; i++, k++){
+					m.data[i*columns + j] = v[k];
+					if(sym != 'g')
+						m.data[j*columns + i] = (sym == 'k')? -v[k]: v[k];
+				}
+			}
+			free(v);
+		}
+		text_free(pieces, n);
+	}
+
+	free(starts);
+	text_unmap(text, len);
+	if(error){
+		cmx_destroy(m);
+		return cmx_make(0, 0);
+	}
+	return m;
+}
+
+/*
+ * Writes d with 15 significant digits if that reads back as exactly d, otherwise 17, which always does
+ * Returns the number of characters written, at most TEXT_MAX_VALUE
+ */
+static size_t text_format(char *buf, double d){
+	double back;
+	int n = snprintf(buf, TEXT_MAX_VALUE + 1, "%.15g", d);
+	if(text_double(buf, buf + n, &back) != NULL && back == d)
+		return (size_t)n;
+	n = snprintf(buf, TEXT_MAX_VALUE + 1, "%.17g", d);
+	return (size_t)n;
+}
+
+/*
+ * Formats lines in batches of about CMX_TEXT_BUFFER bytes across threads, then writes each batch in order
+ * size_t lines - How many lines to write
+ * size_t width - The most characters any one line can take
+ * text_line_f line - Formats one line
+ */
+static void text_write(FILE *f, cmx_matrix_t m, size_t lines, size_t width, text_line_f line, char delim){
+	if(width == 0)
+		width = 1;
+	size_t batch = CMX_TEXT_BUFFER / width;
+	if(batch == 0)
+		batch = 1;
+	if(batch > lines)
+		batch = lines;
+	char *buffer = (char*)malloc(batch * width + 1);
+	size_t *used = (size_t*)malloc(sizeof(size_t) * (batch + 1));
+
+	for(size_t l0 = 0; l0 < lines; l0 += batch){
+		size_t l1 = (l0 + batch < lines)? l0 + batch: lines;
+		#pragma omp parallel for schedule(dynamic)
+		for(size_t l = l0; l < l1; l++)
+			used[l - l0] = line(buffer + (l - l0)*width, m, l, delim);
+		for(size_t l = l0; l < l1; l++)
+			fwrite(buffer + (l - l0)*width, 1, used[l - l0], f);
+	}
+	free(used);
+	free(buffer);
+}
+
+// One row of a CSV file
+static size_t csv_line(char *buf, cmx_matrix_t m, size_t i, char delim){
+	size_t n = 0;
+	for(size_t j = 0; j < m.columns; j++){
+		if(j > 0)
+			buf[n++] = delim;
+		n += text_format(buf + n, m.data[i*m.columns + j]);
+	}
+	buf[n++] = '\n';
+	return n;
+}
+
+/*
+ * Writes a matrix to a CSV file, one row per line
+ * Every value reads back exactly with cmx_load_csv
+ * char* fname - The file name to write to
+ * char delim - The field separator, such as ',' or '\t'
+ */
+void cmx_store_csv(cmx_matrix_t m, char* fname, char delim){
+	FILE *f = fopen(fname, "wb");
+	if(f == NULL){
+		printf("Error opening \'%s\' to write to. Aborting.\n", fname);
+		return;
+	}
+	text_write(f, m, m.rows, m.columns * (TEXT_MAX_VALUE + 1) + 1, csv_line, delim);
+	fclose(f);
+}
+
+// The nonzero entries of one row, as Matrix Market coordinates
+static size_t mtx_coordinate_line(char *buf, cmx_matrix_t m, size_t i, char delim){
+	size_t n = 0;
+	for(size_t j = 0; j < m.columns; j++){
+		double v = m.data[i*m.columns + j];
+		if(v == 0)
+			continue;
+		n += (size_t)sprintf(buf + n, "%zu %zu ", i + 1, j + 1);
+		n += text_format(buf + n, v);
+		buf[n++] = '\n';
+	}
+	return n;
+}
+
+// One column, one value per line, as a Matrix Market array
+static size_t mtx_array_line(char *buf, cmx_matrix_t m, size_t j, char delim){
+	size_t n = 0;
+	for(size_t i = 0; i < m.rows; i++){
+		n += text_format(buf + n, m.data[i*m.columns + j]);
+		buf[n++] = '\n';
+	}
+	return n;
+}
+
+/*
+ * Writes a matrix to a Matrix Market file, real and general
+ * Uses coordinate form when at most a third of the entries are nonzero, otherwise array form
+ * char* fname - The file name to write to
+ */
+void cmx_store_mtx(cmx_matrix_t m, char* fname){
+	FILE *f = fopen(fname, "wb");
+	if(f == NULL){
+		printf("Error opening \'%s\' to write to. Aborting.\n", fname);
+		return;
+	}
+	size_t total = m.rows*m.columns, nonzero = 0;
+	#pragma omp parallel for reduction(+:nonzero) if(total >= CMX_PARALLEL_THRESHOLD)
+	for(size_t i = 0; i < total; i++)
+		nonzero += (m.data[i] != 0);
+
+	if(3*nonzero <= total){
+		fprintf(f, "%%%%MatrixMarket matrix coordinate real general\n");
+		fprintf(f, "%zu %zu %zu\n", m.rows, m.columns, nonzero);
+		// Two indices of up to 20 digits, a value and the spaces and newline between
+		text_write(f, m, m.rows, m.columns * (2*20 + TEXT_MAX_VALUE + 3), mtx_coordinate_line, ' ');
+	}
+	else{
+		fprintf(f, "%%%%MatrixMarket matrix array real general\n");
+		fprintf(f, "%zu %zu\n", m.rows, m.columns);
+		text_write(f, m, m.columns, m.rows * (TEXT_MAX_VALUE + 1), mtx_array_line, ' ');
+	}
+	fclose(f);
+}
@@ -0,0 +1,475 @@
+#define _FILE_OFFSET_BITS 64
+#include <stdint.h>
+#include <sys/types.h>
+#include <cmx_tiled.h>
+#include <cmx_packed.h>
+
+// Bytes taken by the header at the start of a tiled file
+#define TILED_HEADER (3 * sizeof(size_t))
+
+// Byte offset of row i of tile (ti, tj) in the file
+static off_t tiled_offset(cmx_tiled_t *t, size_t ti, size_t tj, size_t i){
+	return (off_t)TILED_HEADER
+		+ ((off_t)(ti*t->tile_columns + tj) * t->tile + i) * t->tile * (off_t)sizeof(double);
+}
+
+/*
+ * Sets up the in-memory side of a tiled matrix around an open file
+ */
+static cmx_tiled_t* tiled_alloc(FILE *f, size_t r, size_t c, size_t tile, size_t cache){
+	cmx_tiled_t *t = (cmx_tiled_t*)malloc(sizeof(cmx_tiled_t));
+	t->f = f;
+	t->rows = r;
+	t->columns = c;
+	t->tile = tile;
+	t->tile_rows = (r + tile - 1) / tile;
+	t->tile_columns = (c + tile - 1) / tile;
+	t->cache_size = (cache < CMX_TILED_MIN_CACHE)? CMX_TILED_MIN_CACHE: cache;
+	t->clock = 0;
+	t->cache = (cmx_tile_slot_t*)malloc(sizeof(cmx_tile_slot_t) * t->cache_size);
+	for(size_t i = 0; i < t->cache_size; i++){
+		t->cache[i].index = SIZE_MAX;
+		t->cache[i].used = 0;
+		t->cache[i].dirty = 0;
+		t->cache[i].data = NULL;
+	}
+	return t;
+}
+
+/*
+ * Writes a cached tile back to the file
+ */
+static void tiled_write_slot(cmx_tiled_t *t, cmx_tile_slot_t *s){
+	size_t ti = s->index / t->tile_columns, tj = s->index % t->tile_columns;
+	fseeko(t->f, tiled_offset(t, ti, tj, 0), SEEK_SET);
+	fwrite(s->data, sizeof(double), t->tile * t->tile, t->f);
+	s->dirty = 0;
+}
+
+/*
+ * Gets tile (ti, tj), loading it into the cache and evicting the least recently used tile if needed
+ * The pointer stays valid until CMX_TILED_MIN_CACHE - 1 other tiles of t have been fetched
+ * int write - Non-zero if the caller will change the tile
+ */
+static double* tiled_tile(cmx_tiled_t *t, size_t ti, size_t tj, int write){
+	size_t index = ti*t->tile_columns + tj;
+	cmx_tile_slot_t *victim = t->cache;
+	t->clock++;
+
+	for(size_t i = 0; i < t->cache_size; i++){
+		cmx_tile_slot_t *s = t->cache + i;
+		if(s->index == index){
+			s->used = t->clock;
+			s->dirty |= write;
+			return s->data;
+		}
+		if(s->used < victim->used) victim = s;
+	}
+
+	if(victim->index != SIZE_MAX && victim->dirty)
+		tiled_write_slot(t, victim);
+	if(victim->data == NULL)
+		victim->data = (double*)malloc(sizeof(double) * t->tile * t->tile);
+
+	fseeko(t->f, tiled_offset(t, ti, tj, 0), SEEK_SET);
+	size_t got = fread(victim->data, sizeof(double), t->tile * t->tile, t->f);
+	for(size_t i = got; i < t->tile * t->tile; i++)
+		victim->data[i] = 0;
+
+	victim->index = index;
+	victim->used = t->clock;
+	victim->dirty = write;
+	return victim->data;
+}
+
+/*
+ * Creates a new tiled matrix file, filled with zeros
+ * char* fname - The file to create. Overwritten if it exists
+ * size_t r - The number of rows in the matrix
+ * size_t c - The number of columns in the matrix
+ * size_t tile - The tile edge, or 0 for CMX_TILE_SIZE
+ * size_t cache - How many tiles to keep in memory, at least CMX_TILED_MIN_CACHE
+ */
+cmx_tiled_t* cmx_tiled_create(char* fname, size_t r, size_t c, size_t tile, size_t cache){
+	if(tile == 0) tile = CMX_TILE_SIZE;
+	FILE *f = fopen(fname, "w+b");
+	if(f == NULL){
+		printf("Error opening \'%s\' to write to. Aborting.\n", fname);
+		return NULL;
+	}
+	cmx_tiled_t *t = tiled_alloc(f, r, c, tile, cache);
+	fwrite(&(t->rows), sizeof(size_t), 1, f);
+	fwrite(&(t->columns), sizeof(size_t), 1, f);
+	fwrite(&(t->tile), sizeof(size_t), 1, f);
+
+	// Extend the file to full size without writing every zero
+	if(t->tile_rows * t->tile_columns > 0){
+		fseeko(f, tiled_offset(t, t->tile_rows, 0, 0) - 1, SEEK_SET);
+		fputc(0, f);
+	}
+	return t;
+}
+
+/*
+ * Opens an existing tiled matrix file for reading and writing
+ * char* fname - The file to open
+ * size_t cache - How many tiles to keep in memory, at least CMX_TILED_MIN_CACHE
+ */
+cmx_tiled_t* cmx_tiled_open(char* fname, size_t cache){
+	FILE *f = fopen(fname, "r+b");
+	if(f == NULL){
+		printf("Error opening \'%s\' to read from. Aborting.\n", fname);
+		return NULL;
+	}
+	size_t head[3];
+	if(fread(head, sizeof(size_t), 3, f) != 3 || head[2] == 0){
+		printf("Error: \'%s\' is not a tiled matrix file. Aborting.\n", fname);
+		fclose(f);
+		return NULL;
+	}
+	return tiled_alloc(f, head[0], head[1], head[2], cache);
+}
+
+/*
+ * Writes every changed tile in the cache back to the file
+ * cmx_tiled_t *t - The tiled matrix to flush
+ */
+int cmx_tiled_flush(cmx_tiled_t *t){
+	for(size_t i = 0; i < t->cache_size; i++)
+		if(t->cache[i].index != SIZE_MAX && t->cache[i].dirty)
+			tiled_write_slot(t, t->cache + i);
+	return fflush(t->f);
+}
+
+/*
+ * Flushes and closes a tiled matrix, freeing its cache. The file is kept
+ * cmx_tiled_t *t - The tiled matrix to close
+ */
+int cmx_tiled_close(cmx_tiled_t *t){
+	cmx_tiled_flush(t);
+	fclose(t->f);
+	for(size_t i = 0; i < t->cache_size; i++)
+		free(t->cache[i].data);
+	free(t->cache);
+	free(t);
+	return 0;
+}
+
+/*
+ * Gets the value in the matrix cell (r, c)
+ * cmx_tiled_t *t - The tiled matrix to get the value from
+ * size_t r - The row to get the cell from
+ * size_t c - The column to get the cell from
+ */
+double cmx_tiled_get(cmx_tiled_t *t, size_t r, size_t c){
+	if(r >= t->rows || c >= t->columns){
+		printf("Index out of bounds error accessing tiled matrix at (%zu,%zu). Matrix has size %zux%zu\n", r, c, t->rows, t->columns);
+		return 0;
+	}
+	return tiled_tile(t, r / t->tile, c / t->tile, 0)[(r % t->tile)*t->tile + c % t->tile];
+}
+
+/*
+ * Puts the value, double d into the cell specified
+ * cmx_tiled_t *t - The tiled matrix to put the value in
+ * double d - The value to put in the cell
+ * size_t r - The index of the row
+ * size_t c - The index of the column
+ */
+cmx_tiled_t* cmx_tiled_put(cmx_tiled_t *t, double d, size_t r, size_t c){
+	if(r >= t->rows || c >= t->columns){
+		printf("Index out of bounds error accessing tiled matrix at (%zu,%zu). Matrix has size %zux%zu\n", r, c, t->rows, t->columns);
+		return t;
+	}
+	tiled_tile(t, r / t->tile, c / t->tile, 1)[(r % t->tile)*t->tile + c % t->tile] = d;
+	return t;
+}
+
+/*
+ * Creates a tiled matrix file holding a copy of an in-memory matrix
+ * cmx_matrix_t m - The matrix to copy
+ * char* fname - The file to create
+ * size_t tile - The tile edge, or 0 for CMX_TILE_SIZE
+ * size_t cache - How many tiles to keep in memory
+ */
+cmx_tiled_t* cmx_tiled_from_matrix(cmx_matrix_t m, char* fname, size_t tile, size_t cache){
+	cmx_tiled_t *t = cmx_tiled_create(fname, m.rows, m.columns, tile, cache);
+	if(t == NULL) return NULL;
+	for(size_t ti = 0; ti < t->tile_rows; ti++){
+		for(size_t tj = 0; tj < t->tile_columns; tj++){
+			double *d = tiled_tile(t, ti, tj, 1);
+			for(size_t i = 0; i < t->tile && ti*t->tile + i < m.rows; i++)
+				for(size_t j = 0; j < t->tile && tj*t->tile + j < m.columns; j++)
+					d[i*t->tile + j] = m.data[(ti*t->tile + i)*m.columns + tj*t->tile + j];
+		}
+	}
+	return t;
+}
+
+/*
+ * Reads a whole tiled matrix into memory
+ * cmx_tiled_t *t - The tiled matrix to read
+ */
+cmx_matrix_t cmx_tiled_to_matrix(cmx_tiled_t *t){
+	cmx_matrix_t m = cmx_make(t->rows, t->columns);
+	for(size_t ti = 0; ti < t->tile_rows; ti++){
+		for(size_t tj = 0; tj < t->tile_columns; tj++){
+			double *d = tiled_tile(t, ti, tj, 0);
+			for(size_t i = 0; i < t->tile && ti*t->tile + i < m.rows; i++)
+				for(size_t j = 0; j < t->tile && tj*t->tile + j < m.columns; j++)
+					m.data[(ti*t->tile + i)*m.columns + tj*t->tile + j] = d[i*t->tile + j];
+		}
+	}
+	return m;
+}
+
+/*
+ * Converts a matrix stored with cmx_store_file into a tiled matrix file, one row in memory at a time
+ * Records from cmx_packed_store_file count towards index as they do for cmx_load_file.
+ * A packed record is read whole, as only its stored entries, and expanded a row at a time
+ * char* src - The file written by cmx_store_file
+ * size_t index - Which matrix in the file to convert, counting from 0
+ * char* fname - The tiled file to create
+ * size_t tile - The tile edge, or 0 for CMX_TILE_SIZE
+ * size_t cache - How many tiles to keep in memory
+ */
+cmx_tiled_t* cmx_tiled_from_file(char* src, size_t index, char* fname, size_t tile, size_t cache){
+	FILE *f = fopen(src, "rb");
+	if(f == NULL){
+		printf("Error opening \'%s\' to read from. Aborting.\n", src);
+		return NULL;
+	}
+	size_t rows, columns;
+	cmx_packed_t p = {0, 0, 0, 0, 0, NULL};
+	for(size_t i = 0; ; i++){
+		if(fread(&rows, sizeof(size_t), 1, f) != 1){
+			printf("Error: \'%s\' has no matrix %zu. Aborting.\n", src, index);
+			fclose(f);
+			return NULL;
+		}
+		if(rows == CMX_PACKED_MARKER){
+			// Packed records skip past their entries, or are read whole if they are the one wanted
+			size_t header[5];
+			if(i == index){
+				if(cmx_packed_fread(f, &p)){
+					printf("Error reading packed matrix %zu from \'%s\'. Aborting.\n", index, src);
+					fclose(f);
+					return NULL;
+				}
+				rows = columns = p.n;
+				break;
+			}
+			if(fread(header, sizeof(size_t), 5, f) != 5){
+				printf("Error: \'%s\' has no matrix %zu. Aborting.\n", src, index);
+				fclose(f);
+				return NULL;
+			}
+			cmx_packed_t skip = {(char)header[0], (char)header[1], header[2], header[3], header[4], NULL};
+			fseeko(f, (off_t)cmx_packed_length(skip) * sizeof(double), SEEK_CUR);
+			continue;
+		}
+		if(fread(&columns, sizeof(size_t), 1, f) != 1){
+			printf("Error: \'%s\' has no matrix %zu. Aborting.\n", src, index);
+			fclose(f);
+			return NULL;
+		}
+		if(i == index) break;
+		fseeko(f, (off_t)rows * columns * sizeof(double), SEEK_CUR);
+	}
+
+	cmx_tiled_t *t = cmx_tiled_create(fname, rows, columns, tile, cache);
+	if(t == NULL){
+		cmx_packed_destroy(p);
+		fclose(f);
+		return NULL;
+	}
+	// Nothing is cached yet, so each row is scattered straight to its tiles
+	double *row = (double*)malloc(sizeof(double) * columns);
+	for(size_t r = 0; r < rows; r++){
+		if(p.data != NULL){
+			for(size_t c = 0; c < columns; c++)
+				row[c] = cmx_packed_get(p, r, c);
+		}
+		else if(fread(row, sizeof(double), columns, f) != columns){
+			printf("Error: \'%s\' ended early, remaining rows left as zero.\n", src);
+			break;
+		}
+		for(size_t tj = 0; tj < t->tile_columns; tj++){
+			size_t c0 = tj*t->tile;
+			size_t len = (c0 + t->tile < columns)? t->tile: columns - c0;
+			fseeko(t->f, tiled_offset(t, r / t->tile, tj, r % t->tile), SEEK_SET);
+			fwrite(row + c0, sizeof(double), len, t->f);
+		}
+	}
+	free(row);
+	cmx_packed_destroy(p);
+	fclose(f);
+	return t;
+}
+
+/*
+ * Stores a tiled matrix in the format of cmx_store_file, one row in memory at a time
+ * cmx_tiled_t *t - The tiled matrix to store
+ * char* fname - The file name to store in
+ * char mode - 'w'rite or 'a'ppend to the file
+ */
+void cmx_tiled_store_file(cmx_tiled_t *t, char* fname, char mode){
+	FILE *f = NULL;
+	if(mode == 'w')
+		f = fopen(fname, "wb");
+	else if(mode == 'a')
+		f = fopen(fname, "ab");
+	else
+		printf("Error opening \'%s\'. Write mode \'%c\'not recognised", fname, mode);
+	if(f == NULL){
+		printf("Error opening \'%s\' to write to. Aborting.\n", fname);
+		return;
+	}
+
+	cmx_tiled_flush(t);
+	fwrite(&(t->rows), sizeof(size_t), 1, f);
+	fwrite(&(t->columns), sizeof(size_t), 1, f);
+	double *row = (double*)malloc(sizeof(double) * t->columns);
+	for(size_t r = 0; r < t->rows; r++){
+		for(size_t tj = 0; tj < t->tile_columns; tj++){
+			size_t c0 = tj*t->tile;
+			size_t len = (c0 + t->tile < t->columns)? t->tile: t->columns - c0;
+			fseeko(t->f, tiled_offset(t, r / t->tile, tj, r % t->tile), SEEK_SET);
+			if(fread(row + c0, sizeof(double), len, t->f) != len)
+				for(size_t j = 0; j < len; j++) row[c0 + j] = 0;
+		}
+		fwrite(row, sizeof(double), t->columns, f);
+	}
+	free(row);
+	fclose(f);
+}
+
+/*
+ * Multiplies tiled matrices, C = A B, into a new tiled file
+ * For each band of A's tile rows, as many of its tiles as fit in A's cache are held while
+ * every tile column of B streams past them, in alternating directions so the tiles at
+ * each turn are reused. Each tile of A is read once and each C tile once per chunk of A.
+ * Tile products go through cmx_gemm
+ * cmx_tiled_t *a - The first matrix
+ * cmx_tiled_t *b - The second matrix, with the same tile edge as a
+ * char* fname - The file for the result, which gets a's tile edge and cache size
+ */
+cmx_tiled_t* cmx_tiled_product(cmx_tiled_t *a, cmx_tiled_t *b, char* fname){
+	if(a->columns != b->rows || a->tile != b->tile){
+		printf("Size mismatch when multiplying tiled matrices together. Given %zux%zu and %zux%zu with tiles %zu and %zu\n", a->rows, a->columns, b->rows, b->columns, a->tile, b->tile);
+		return NULL;
+	}
+	cmx_tiled_t *c = cmx_tiled_create(fname, a->rows, b->columns, a->tile, a->cache_size);
+	if(c == NULL) return NULL;
+	size_t tile = a->tile, nk = a->tile_columns, nj = b->tile_columns;
+
+	for(size_t ti = 0; ti < a->tile_rows; ti++){
+		int forward = 1;
+		for(size_t k0 = 0; k0 < nk; k0 += a->cache_size){
+			size_t k1 = (k0 + a->cache_size < nk)? k0 + a->cache_size: nk;
+			for(size_t s = 0; s < nj; s++){
+				size_t tj = forward? s: nj - 1 - s;
+				double *ct = tiled_tile(c, ti, tj, 1);
+				// Fetched again each time so a and b may be the same matrix
+				for(size_t k = k0; k < k1; k++){
+					double *at = tiled_tile(a, ti, k, 0);
+					double *bt = tiled_tile(b, k, tj, 0);
+					cmx_gemm('n', 'n', tile, tile, tile, 1.0, at, tile, bt, tile, 1.0, ct, tile);
+				}
+			}
+			forward = !forward;
+		}
+	}
+	return c;
+}
+
+/*
+ * Transposes a tiled matrix into a new tiled file, reading and writing each tile once
+ * cmx_tiled_t *t - The matrix to transpose
+ * char* fname - The file for the result, which gets t's tile edge and cache size
+ */
+cmx_tiled_t* cmx_tiled_transpose(cmx_tiled_t *t, char* fname){
+	cmx_tiled_t *r = cmx_tiled_create(fname, t->columns, t->rows, t->tile, t->cache_size);
+	if(r == NULL) return NULL;
+	size_t tile = t->tile;
+	for(size_t ti = 0; ti < t->tile_rows; ti++){
+		for(size_t tj = 0; tj < t->tile_columns; tj++){
+			double *src = tiled_tile(t, ti, tj, 0);
+			double *dst = tiled_tile(r, tj, ti, 1);
+			for(size_t i = 0; i < tile; i++)
+				for(size_t j = 0; j < tile; j++)
+					dst[j*tile + i] = src[i*tile + j];
+		}
+	}
+	return r;
+}
+
+/*
+ * Adds two tiled matrices together, tile by tile
+ * cmx_tiled_t *a - The first matrix, overwritten with the result
+ * cmx_tiled_t *b - The second matrix, with the same size and tile edge. Left unchanged
+ */
+cmx_tiled_t* cmx_tiled_add(cmx_tiled_t *a, cmx_tiled_t *b){
+	if(a->rows != b->rows || a->columns != b->columns || a->tile != b->tile){
+		printf("ERROR: Tiled matrix mismatch when adding, have a %zu,%zu and %zu,%zu with tiles %zu and %zu\n", a->rows, a->columns, b->rows, b->columns, a->tile, b->tile);
+		return a;
+	}
+	size_t len = a->tile * a->tile;
+	for(size_t ti = 0; ti < a->tile_rows; ti++){
+		for(size_t tj = 0; tj < a->tile_columns; tj++){
+			double *x = tiled_tile(a, ti, tj, 1);
+			double *y = tiled_tile(b, ti, tj, 0);
+			for(size_t i = 0; i < len; i++)
+				x[i] += y[i];
+		}
+	}
+	return a;
+}
+
+/*
+ * Sums the values, or their squares, over every tile. The zero padding adds nothing
+ */
+static double tiled_reduce(cmx_tiled_t *t, int square){
+	double s = 0;
+	size_t len = t->tile * t->tile;
+	for(size_t ti = 0; ti < t->tile_rows; ti++){
+		for(size_t tj = 0; tj < t->tile_columns; tj++){
+			double *d = tiled_tile(t, ti, tj, 0);
+			for(size_t i = 0; i < len; i++)
+				s += square? d[i]*d[i]: d[i];
+		}
+	}
+	return s;
+}
+
+/*
+ * Gets the algebraic sum of the contents
+ * cmx_tiled_t *t - The tiled matrix to find the sum of
+ */
+double cmx_tiled_sum(cmx_tiled_t *t){
+	return tiled_reduce(t, 0);
+}
+
+/*
+ * Gets the algebraic mean of the contents
+ * cmx_tiled_t *t - The tiled matrix to find the mean of
+ */
+double cmx_tiled_mean(cmx_tiled_t *t){
+	return tiled_reduce(t, 0)/(t->rows*t->columns);
+}
+
+/*
+ * Gets the sum of the squares of the contents
+ * cmx_tiled_t *t - The tiled matrix to find the square sum of
+ */
+double cmx_tiled_sqsum(cmx_tiled_t *t){
+	return tiled_reduce(t, 1);
+}
+
+/*
+ * Gets the root mean square of the contents
+ * cmx_tiled_t *t - The tiled matrix to take the rms of
+ */
+double cmx_tiled_rms(cmx_tiled_t *t){
+	return pow(tiled_reduce(t, 1)/(t->rows*t->columns), 0.5);
+}